@@ -27,6 +27,8 @@ namespace pm {
 
 using android::binder::Status;
 
+static const int32_t LIST_CHUNK_SIZE = 8;
+
 class InstallListener : public BnInstallObserver, public std::promise<int32_t> {
 public:
     Status onInstallProcess(const std::string &packageName, int32_t process) override {
@@ -52,6 +54,25 @@ public:
     }
 };
 
+class ChangeListener : public BnPackageChangeObserver, public std::promise<void> {
+public:
+    explicit ChangeListener(int remaining) : mRemaining(remaining) {}
+
+    Status onPackagesChanged(const PackageChangeEvent &event) override {
+        printf("generation %" PRIi32 "\n", event.generation);
+        for (const auto &name : event.added) printf("  + %s\n", name.c_str());
+        for (const auto &name : event.removed) printf("  - %s\n", name.c_str());
+        for (const auto &name : event.updated) printf("  * %s\n", name.c_str());
+        if (--mRemaining == 0) {
+            this->set_value();
+        }
+        return Status::ok();
+    }
+
+private:
+    int mRemaining; /* oneway calls from one sender are delivered in order */
+};
+
 PmCommand::PmCommand() : mNextArg(0) {}
 
 PmCommand::~PmCommand() {}
@@ -103,20 +124,47 @@ int PmCommand::runList() {
     std::string_view arg = nextArg();
     int status = 0;
     if (arg == "-l") {
+        PackageFilter filter;
+        bool filtered = false;
+        for (std::string_view opt = nextArg(); !opt.empty(); opt = nextArg()) {
+            if (opt == "-t") {
+                filter.appType = nextArg();
+            } else if (opt == "-s") {
+                filter.systemUI = PackageFilter::SYSTEM_UI_ONLY;
+            } else if (opt == "-S") {
+                filter.systemUI = PackageFilter::SYSTEM_UI_EXCLUDE;
+            } else {
+                return showUsage();
+            }
+            filtered = true;
+        }
         std::vector<std::string> pkgNames;
-        status = pm.getAllPackageName(&pkgNames);
+        status = filtered ? pm.getPackageNames(filter, &pkgNames)
+                          : pm.getAllPackageName(&pkgNames);
         for (size_t i = 0; i < pkgNames.size(); i++) {
             printf("%s\n", pkgNames[i].c_str());
         }
     } else {
+        // stream the registry so the shell never holds every package at once
+        int32_t cursor = 0;
+        status = pm.openPackageCursor(PACKAGE_FIELD_ALL, &cursor);
         std::vector<PackageInfo> pkgInfos;
-        status = pm.getAllPackageInfo(&pkgInfos);
-        for (size_t i = 0; i < pkgInfos.size(); i++) {
-            if (arg == "-a") {
-                printf("%s\n", pkgInfos[i].toString().c_str());
-            } else {
-                printf("%s\n", pkgInfos[i].dumpSimplePackageInfo().c_str());
+        while (!status) {
+            pkgInfos.clear();
+            status = pm.fetchPackages(cursor, LIST_CHUNK_SIZE, &pkgInfos);
+            if (pkgInfos.empty()) {
+                break;
             }
+            for (size_t i = 0; i < pkgInfos.size(); i++) {
+                if (arg == "-a") {
+                    printf("%s\n", pkgInfos[i].toString().c_str());
+                } else {
+                    printf("%s\n", pkgInfos[i].dumpSimplePackageInfo().c_str());
+                }
+            }
+        }
+        if (cursor > 0) {
+            pm.closePackageCursor(cursor);
         }
     }
     return status;
@@ -187,15 +235,67 @@ int PmCommand::runFirstBoot() {
     return 0;
 }
 
+int PmCommand::runResolve() {
+    std::string_view arg = nextArg();
+    bool services = arg == "-s";
+    std::string_view action = services ? nextArg() : arg;
+    if (action.empty()) {
+        return showUsage();
+    }
+    std::vector<ResolveInfo> resolveInfos;
+    int status = services ? pm.queryIntentServices(std::string(action), &resolveInfos)
+                          : pm.queryIntentActivities(std::string(action), &resolveInfos);
+    for (const auto &info : resolveInfos) {
+        const std::string &name =
+                info.activityInfo ? info.activityInfo->name : info.serviceInfo->name;
+        printf("%s/%s\n", info.packageName.c_str(), name.c_str());
+    }
+    return status;
+}
+
+int PmCommand::runWatch() {
+    std::string_view arg = nextArg();
+    int count = arg.empty() ? -1 : atoi(std::string(arg).c_str());
+    if (count == 0) {
+        return showUsage();
+    }
+    sp<ChangeListener> listener = new ChangeListener(count);
+    int status = pm.registerPackageChangeObserver(listener);
+    if (status) {
+        printf("register package change observer failed\n");
+        return status;
+    }
+    // without a count this runs until the shell kills it
+    listener->get_future().wait();
+    return pm.unregisterPackageChangeObserver(listener);
+}
+
+int PmCommand::runFailures() {
+    std::vector<ParseFailure> failures;
+    int status = pm.getParseFailures(&failures);
+    if (status) {
+        printf("get parse failures failed\n");
+        return status;
+    }
+    for (const auto &failure : failures) {
+        printf("%s %s error:%d skipped:%d\n", failure.packageName.c_str(),
+               failure.manifest.c_str(), failure.error, failure.skipped);
+    }
+    return 0;
+}
+
 int PmCommand::showUsage() {
     printf("usage: pm [subcommand] [options]\n\n");
     printf("  pm install PATH\n");
     printf("  pm uninstall [-f] PACKAGE\n");
     printf("  pm clear PACKAGE\n");
-    printf("  pm list\n");
+    printf("  pm list [-a | -l [-t TYPE] [-s | -S]]\n");
     printf("  pm get PACKAGE\n");
     printf("  pm stats PACKAGE\n");
     printf("  pm firstboot\n");
+    printf("  pm resolve [-s] ACTION\n");
+    printf("  pm watch [COUNT]\n");
+    printf("  pm failures\n");
     return 0;
 }
 
@@ -232,6 +332,15 @@ int PmCommand::run(int argc, char *argv[]) {
     if (strcmp("firstboot", op) == 0) {
         return runFirstBoot();
     }
+    if (strcmp("resolve", op) == 0) {
+        return runResolve();
+    }
+    if (strcmp("watch", op) == 0) {
+        return runWatch();
+    }
+    if (strcmp("failures", op) == 0) {
+        return runFailures();
+    }
     return showUsage();
 }
 
@@ -33,6 +33,9 @@ public:
     int runGetPackage();
     int runPackageStats();
     int runFirstBoot();
+    int runResolve();
+    int runWatch();
+    int runFailures();
     int showUsage();
     int run(int argc, char *argv[]);
 
@@ -32,6 +32,43 @@ enum ApplicationType { UNKNOWN = -1, NATIVE = 0, QUICKAPP };
 ProcessPriority getProcessPriority(const std::string& str);
 ApplicationType getApplicationType(const std::string& appType);
 
+/* field groups of a PackageInfo query, packageName and parsedFields are always filled */
+enum PackageField : int32_t {
+    PACKAGE_FIELD_LABEL = 1 << 0,      /* name, icon */
+    PACKAGE_FIELD_LAUNCH = 1 << 1,     /* entry, execfile, priority */
+    PACKAGE_FIELD_ACTIVITIES = 1 << 2, /* activitiesInfo */
+    PACKAGE_FIELD_SERVICES = 1 << 3,   /* servicesInfo */
+    PACKAGE_FIELD_QUICKAPP = 1 << 4,   /* extra */
+    PACKAGE_FIELD_VERSION = 1 << 5,    /* appType, version */
+    PACKAGE_FIELD_INSTALL = 1 << 6,    /* installedPath, manifest, installTime, userId, systemUI */
+    PACKAGE_FIELD_STATS = 1 << 7,      /* size, shasum */
+    PACKAGE_FIELD_ALL = (1 << 8) - 1,
+    /* groups that are only known after the manifest is parsed */
+    PACKAGE_FIELD_MANIFEST = PACKAGE_FIELD_LABEL | PACKAGE_FIELD_LAUNCH |
+            PACKAGE_FIELD_ACTIVITIES | PACKAGE_FIELD_SERVICES | PACKAGE_FIELD_QUICKAPP,
+};
+
+/*
+ * Wire encodings of PackageInfo. The requested one rides in the top byte of a fields mask,
+ * the service answers with the newest one both sides know and tags the reply with it.
+ * A full UTF-16 PackageInfo keeps the untagged layout older peers read, see writeToParcel.
+ */
+enum PackageEncoding : int32_t {
+    PACKAGE_ENCODING_UTF16 = 0,   /* every string as UTF-16, every field sent */
+    PACKAGE_ENCODING_COMPACT = 1, /* UTF-8 strings, appType as enum, derived fields dropped */
+    PACKAGE_ENCODING_LATEST = PACKAGE_ENCODING_COMPACT,
+};
+
+#define PACKAGE_ENCODING_SHIFT 24
+
+inline int32_t packageEncoding(int32_t fields) {
+    return (fields >> PACKAGE_ENCODING_SHIFT) & 0xff;
+}
+
+inline int32_t withPackageEncoding(int32_t fields, int32_t encoding) {
+    return (fields & PACKAGE_FIELD_ALL) | (encoding << PACKAGE_ENCODING_SHIFT);
+}
+
 class PackageInfo : public ::android::Parcelable {
 public:
     std::string packageName;
@@ -52,12 +89,25 @@ public:
     int32_t priority;
     int32_t userId;
     int64_t size;
-    bool bAllValid;
+    int32_t parsedFields = 0; /* PACKAGE_FIELD_MANIFEST groups read from the manifest */
+    int32_t fields = PACKAGE_FIELD_ALL; /* groups carried over binder, see PackageField */
+    int32_t encoding = PACKAGE_ENCODING_UTF16;
 
+    bool isParsed(int32_t groups) const {
+        return (parsedFields & groups) == groups;
+    }
+    /* also settles the encoding, the one requested in mask or the newest known */
+    void assignFields(const PackageInfo& other, int32_t mask);
     android::status_t readFromParcel(const android::Parcel* parcel) final;
     android::status_t writeToParcel(android::Parcel* parcel) const final;
     std::string toString() const;
     std::string dumpSimplePackageInfo();
+
+private:
+    android::status_t readLegacy(const android::Parcel* parcel);
+    android::status_t writeLegacy(android::Parcel* parcel) const;
+    android::status_t readCompact(const android::Parcel* parcel);
+    android::status_t writeCompact(android::Parcel* parcel) const;
 }; // class PackageInfo
 } // namespace pm
 } // namespace os
\ No newline at end of file
@@ -16,31 +16,74 @@
 
 #pragma once
 
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
 #include "os/pm/BnInstallObserver.h"
+#include "os/pm/BnPackageChangeObserver.h"
 #include "os/pm/BnUninstallObserver.h"
 #include "os/pm/IPackageManager.h"
+#include "os/pm/PackageFilter.h"
 #include "os/pm/PackageStats.h"
+#include "os/pm/ParseFailure.h"
+#include "os/pm/ResolveInfo.h"
 
 namespace os {
 namespace pm {
 
 using android::sp;
 
+class PackageGeneration;
+
 class PackageManager {
 public:
     PackageManager();
+    ~PackageManager();
+    /*
+     * Keep the PackageInfo returned by getPackageInfo in process. Hits are checked against the
+     * registry generation in shared memory and cost no binder call. Off by default.
+     */
+    void setCacheEnabled(bool enabled);
     int32_t getAllPackageInfo(std::vector<PackageInfo> *pkgsInfo);
     int32_t getPackageInfo(const std::string &packageName, PackageInfo *info);
+    /* only the PackageField groups in fields are filled, the rest is left untouched */
+    int32_t getAllPackageInfo(int32_t fields, std::vector<PackageInfo> *pkgsInfo);
+    int32_t getPackageInfo(const std::string &packageName, int32_t fields, PackageInfo *info);
+    /* one binder call for all names, statuses holds 0 or the error of each name in order */
+    int32_t getPackageInfos(const std::vector<std::string> &packageNames, int32_t fields,
+                            std::vector<PackageInfo> *pkgsInfo, std::vector<int32_t> *statuses);
+    /* fetchPackages returns at most count packages per call and none once the cursor is done */
+    int32_t openPackageCursor(int32_t fields, int32_t *cursor);
+    int32_t fetchPackages(int32_t cursor, int32_t count, std::vector<PackageInfo> *pkgsInfo);
+    int32_t closePackageCursor(int32_t cursor);
     int32_t clearAppCache(const std::string &packageName);
     int32_t installPackage(const InstallParam &param, sp<BnInstallObserver> listener = nullptr);
     int32_t uninstallPackage(const UninstallParam &param,
                              sp<BnUninstallObserver> listener = nullptr);
     int32_t getPackageSizeInfo(const std::string &packageName, PackageStats *stats);
     int32_t isFirstBoot(bool *firstBoot);
+    int32_t getGeneration(int32_t *generation);
+    int32_t getParseFailures(std::vector<ParseFailure> *failures);
+    int32_t registerPackageChangeObserver(const sp<BnPackageChangeObserver> &observer);
+    int32_t unregisterPackageChangeObserver(const sp<BnPackageChangeObserver> &observer);
     int32_t getAllPackageName(std::vector<std::string> *pkgNames);
+    int32_t getPackageNames(const PackageFilter &filter, std::vector<std::string> *pkgNames);
+    int32_t resolveActivity(const std::string &action, ResolveInfo *resolveInfo);
+    int32_t queryIntentActivities(const std::string &action,
+                                  std::vector<ResolveInfo> *resolveInfos);
+    int32_t queryIntentServices(const std::string &action, std::vector<ResolveInfo> *resolveInfos);
 
 private:
+    bool lookupCache(const std::string &packageName, PackageInfo *info);
+    void storeCache(uint32_t generation, const PackageInfo &info);
+
     sp<IPackageManager> mService;
+    std::mutex mCacheLock;
+    PackageGeneration *mGeneration; /* mapped when the cache is enabled */
+    std::list<PackageInfo> mCacheOrder; /* most recently used first, the tail is evicted */
+    std::unordered_map<std::string, std::list<PackageInfo>::iterator> mCache;
+    uint32_t mCacheGeneration;
 }; // class PackageManager
 
 } // namespace pm
@@ -17,11 +17,20 @@
 #pragma once
 
 #include <utils/String16.h>
+#include <utils/Vector.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 #include "os/pm/BnPackageManager.h"
+#include "os/pm/IPackageChangeObserver.h"
 #include "os/pm/IPackageManager.h"
 #include "os/pm/InstallParam.h"
+#include "os/pm/PackageFilter.h"
 #include "os/pm/PackageStats.h"
+#include "os/pm/ParseFailure.h"
+#include "os/pm/ResolveInfo.h"
 #include "os/pm/UninstallParam.h"
 
 namespace os {
@@ -29,8 +38,17 @@ namespace pm {
 
 using android::binder::Status;
 
+class PackageChangeNotifier;
+class PackageCursorTable;
+class PackageFlusher;
+class PackageGeneration;
+class PackageIdleTask;
+class PackageInstallScheduler;
 class PackageInstaller;
 class PackageParser;
+class PackageRegistry;
+class PackageSizeCache;
+struct DirectoryStamp;
 
 class PackageManagerService : public BnPackageManager {
 public:
@@ -38,23 +56,65 @@ public:
     ~PackageManagerService();
     Status getAllPackageInfo(std::vector<PackageInfo> *pkgInfos);
     Status getPackageInfo(const std::string &packageName, PackageInfo *pkgInfo);
+    Status getAllPackageInfoFields(int32_t fields, std::vector<PackageInfo> *pkgInfos);
+    Status getPackageInfoFields(const std::string &packageName, int32_t fields,
+                                PackageInfo *pkgInfo);
+    Status getPackageInfos(const std::vector<std::string> &packageNames, int32_t fields,
+                           std::vector<int32_t> *statuses, std::vector<PackageInfo> *pkgInfos);
+    Status openPackageCursor(int32_t fields, int32_t *cursor);
+    Status fetchPackages(int32_t cursor, int32_t count, std::vector<PackageInfo> *pkgInfos);
+    Status closePackageCursor(int32_t cursor);
+    Status getParseFailures(std::vector<ParseFailure> *failures);
     Status clearAppCache(const std::string &packageName, int32_t *ret);
     Status installPackage(const InstallParam &param, const android::sp<IInstallObserver> &observer);
     Status uninstallPackage(const UninstallParam &param,
                             const android::sp<IUninstallObserver> &observer);
     Status getPackageSizeInfo(const std::string &packageName, PackageStats *pkgStats);
     Status isFirstBoot(bool *firstBoot);
+    Status getGeneration(int32_t *generation);
+    Status registerPackageChangeObserver(const android::sp<IPackageChangeObserver> &observer);
+    Status unregisterPackageChangeObserver(const android::sp<IPackageChangeObserver> &observer);
     Status getAllPackageName(std::vector<std::string> *pkgNames);
+    Status getPackageNames(const PackageFilter &filter, std::vector<std::string> *pkgNames);
+    Status resolveActivity(const std::string &action, ResolveInfo *resolveInfo);
+    Status queryIntentActivities(const std::string &action,
+                                 std::vector<ResolveInfo> *resolveInfos);
+    Status queryIntentServices(const std::string &action, std::vector<ResolveInfo> *resolveInfos);
+    android::status_t dump(int fd, const android::Vector<android::String16> & /* args */) override;
     static android::String16 name() {
         return android::String16("package");
     }
 
 private:
     void init();
+    void runInstall(const InstallParam &param, const android::sp<IInstallObserver> &observer);
+    std::vector<PackageInfo> scanPackages(const std::vector<std::string> &scanPath,
+                                          std::vector<DirectoryStamp> *stamps, bool incremental,
+                                          std::map<std::string, PackageInfo> *packages);
+    std::shared_ptr<const PackageInfo> completeEntry(
+            const std::shared_ptr<const PackageInfo> &entry, int32_t fields = PACKAGE_FIELD_ALL);
+    void upgradePackageAttributes(std::map<std::string, PackageInfo> *packages);
+    /* Without unpublished it waits for the publish, with it the entries a busy writer
+     * kept from being published are handed back instead. */
+    void parsePendingEntries(std::vector<std::shared_ptr<const PackageInfo>> *unpublished);
+    /* An unparsed entry whose manifest has a recorded failure, known without file I/O. */
+    bool isBroken(const PackageInfo &info);
+    void queryIntent(const std::string &action, int32_t kind,
+                     std::vector<ResolveInfo> *resolveInfos);
     bool mFirstBoot;
-    std::map<std::string, PackageInfo> mPackageInfo;
+    std::mutex mLock; /* serializes installs and uninstalls, readers go through mRegistry */
+    PackageRegistry *mRegistry;
+    PackageFlusher *mFlusher;
     PackageInstaller *mInstaller;
     PackageParser *mParser;
+    PackageSizeCache *mSizeCache;
+    PackageInstallScheduler *mScheduler;
+    PackageCursorTable *mCursors;
+    PackageGeneration *mGeneration;
+    PackageChangeNotifier *mNotifier;
+    PackageIdleTask *mIdleParse;
+    /* registry version whose remaining unparsed entries all failed, queries skip the walk */
+    std::atomic<uint64_t> mSettledVersion;
 }; // class PackageManagerService
 
 } // namespace pm
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageChangeNotifier.h"
+
+#include <utils/Log.h>
+
+#include <algorithm>
+
+namespace os {
+namespace pm {
+
+using android::IBinder;
+using android::IInterface;
+using android::sp;
+
+PackageChangeNotifier::PackageChangeNotifier(PackageFlusher *flusher)
+      : mGeneration(0), mDeathRecipient(new DeathRecipient(this)), mFlusher(flusher) {
+    mTask = mFlusher->addTask([this]() { return dispatch(); });
+}
+
+PackageChangeNotifier::~PackageChangeNotifier() {
+    for (const auto &observer : mObservers) {
+        IInterface::asBinder(observer)->unlinkToDeath(mDeathRecipient);
+    }
+}
+
+void PackageChangeNotifier::DeathRecipient::binderDied(const android::wp<IBinder> &who) {
+    // still referenced from mObservers, so the proxy can be promoted
+    sp<IBinder> binder = who.promote();
+    if (binder) {
+        std::lock_guard<std::mutex> lock(mNotifier->mLock);
+        mNotifier->remove(binder);
+    }
+}
+
+int PackageChangeNotifier::registerObserver(const sp<IPackageChangeObserver> &observer) {
+    if (observer == nullptr) {
+        return android::BAD_VALUE;
+    }
+    sp<IBinder> binder = IInterface::asBinder(observer);
+    std::lock_guard<std::mutex> lock(mLock);
+    for (const auto &registered : mObservers) {
+        if (IInterface::asBinder(registered) == binder) {
+            return android::ALREADY_EXISTS;
+        }
+    }
+    // an observer living in this process can't die on its own
+    int ret = binder->localBinder() ? 0 : binder->linkToDeath(mDeathRecipient);
+    if (ret) {
+        ALOGE("link to death of package change observer failed:%d", ret);
+        return ret;
+    }
+    mObservers.push_back(observer);
+    return 0;
+}
+
+int PackageChangeNotifier::unregisterObserver(const sp<IPackageChangeObserver> &observer) {
+    if (observer == nullptr) {
+        return android::BAD_VALUE;
+    }
+    sp<IBinder> binder = IInterface::asBinder(observer);
+    binder->unlinkToDeath(mDeathRecipient);
+    std::lock_guard<std::mutex> lock(mLock);
+    size_t count = mObservers.size();
+    remove(binder);
+    return mObservers.size() < count ? 0 : android::NAME_NOT_FOUND;
+}
+
+void PackageChangeNotifier::remove(const sp<IBinder> &binder) {
+    mObservers.erase(std::remove_if(mObservers.begin(), mObservers.end(),
+                                    [&](const sp<IPackageChangeObserver> &observer) {
+                                        return IInterface::asBinder(observer) == binder;
+                                    }),
+                     mObservers.end());
+}
+
+void PackageChangeNotifier::post(PackageChange change, const std::string &packageName,
+                                 uint32_t generation) {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mGeneration = generation;
+        if (mObservers.empty()) {
+            return;
+        }
+
+        auto it = mPending.find(packageName);
+        if (it == mPending.end()) {
+            mPending.emplace(packageName, change);
+        } else if (it->second == PACKAGE_ADDED) {
+            // nobody saw the add yet, a remove cancels it and an update is still an add
+            if (change == PACKAGE_REMOVED) {
+                mPending.erase(it);
+            }
+        } else {
+            // a package that was removed and installed again only shows up as updated
+            it->second = change == PACKAGE_REMOVED ? PACKAGE_REMOVED : PACKAGE_UPDATED;
+        }
+    }
+    // unlocked, a flusher without a thread dispatches right here and takes mLock again
+    mFlusher->schedule(mTask);
+}
+
+int PackageChangeNotifier::dispatch() {
+    PackageChangeEvent event;
+    std::vector<sp<IPackageChangeObserver>> observers;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (mPending.empty()) {
+            return 0;
+        }
+        for (const auto &[packageName, change] : mPending) {
+            switch (change) {
+                case PACKAGE_ADDED:
+                    event.added.push_back(packageName);
+                    break;
+                case PACKAGE_REMOVED:
+                    event.removed.push_back(packageName);
+                    break;
+                default:
+                    event.updated.push_back(packageName);
+                    break;
+            }
+        }
+        mPending.clear();
+        event.generation = static_cast<int32_t>(mGeneration);
+        observers = mObservers;
+    }
+
+    // oneway calls, a slow observer doesn't hold up the others
+    for (const auto &observer : observers) {
+        android::binder::Status status = observer->onPackagesChanged(event);
+        if (!status.isOk()) {
+            ALOGW("notify package change failed:%s", status.toString8().c_str());
+        }
+    }
+    return 0;
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <binder/IBinder.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "PackageFlusher.h"
+#include "os/pm/IPackageChangeObserver.h"
+
+namespace os {
+namespace pm {
+
+enum PackageChange { PACKAGE_ADDED = 0, PACKAGE_REMOVED, PACKAGE_UPDATED };
+
+/*
+ * Fans registry changes out to the registered IPackageChangeObserver.
+ *
+ * Changes are queued per package and folded into their net effect, an add
+ * followed by a remove within one batch is never reported. The batch is sent
+ * from the flusher thread, so a burst of installs costs each observer a
+ * single oneway call.
+ */
+class PackageChangeNotifier {
+public:
+    explicit PackageChangeNotifier(PackageFlusher *flusher);
+    ~PackageChangeNotifier();
+    int registerObserver(const android::sp<IPackageChangeObserver> &observer);
+    int unregisterObserver(const android::sp<IPackageChangeObserver> &observer);
+    void post(PackageChange change, const std::string &packageName, uint32_t generation);
+
+private:
+    class DeathRecipient : public android::IBinder::DeathRecipient {
+    public:
+        explicit DeathRecipient(PackageChangeNotifier *notifier) : mNotifier(notifier) {}
+        void binderDied(const android::wp<android::IBinder> &who) override;
+
+    private:
+        PackageChangeNotifier *mNotifier;
+    };
+    int dispatch();
+    /* called with mLock held */
+    void remove(const android::sp<android::IBinder> &binder);
+
+    std::mutex mLock;
+    std::vector<android::sp<IPackageChangeObserver>> mObservers;
+    std::map<std::string, PackageChange> mPending;
+    uint32_t mGeneration;
+    android::sp<DeathRecipient> mDeathRecipient;
+    PackageFlusher *mFlusher;
+    size_t mTask;
+}; // class PackageChangeNotifier
+
+} // namespace pm
+} // namespace os
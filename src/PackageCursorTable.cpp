@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageCursorTable.h"
+
+#include <utils/Log.h>
+
+#include <algorithm>
+#include <cinttypes>
+
+namespace os {
+namespace pm {
+
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_MAX_CURSORS
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_MAX_CURSORS 8
+#endif
+
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_CURSOR_CHUNK
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_CURSOR_CHUNK 16
+#endif
+
+PackageCursorTable::PackageCursorTable() : mNextId(1), mClock(0) {}
+
+int32_t PackageCursorTable::open(pid_t owner, int32_t fields, Entries entries) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mCursors.size() >= CONFIG_SYSTEM_PACKAGE_SERVICE_MAX_CURSORS) {
+        auto victim = std::min_element(mCursors.begin(), mCursors.end(),
+                                       [](const auto &a, const auto &b) {
+                                           return a.second.lastUsed < b.second.lastUsed;
+                                       });
+        ALOGW("too many package cursors, drop %" PRIi32 " of pid %d", victim->first,
+              victim->second.owner);
+        mCursors.erase(victim);
+    }
+
+    int32_t id = mNextId;
+    // ids stay positive and aren't reused while the old cursor may still be around
+    mNextId = mNextId == INT32_MAX ? 1 : mNextId + 1;
+    mCursors[id] = Cursor{owner, fields, std::move(entries), 0, ++mClock};
+    return id;
+}
+
+bool PackageCursorTable::take(int32_t cursor, pid_t owner, size_t count, int32_t *fields,
+                              Entries *chunk) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mCursors.find(cursor);
+    if (it == mCursors.end() || it->second.owner != owner) {
+        return false;
+    }
+
+    Cursor &state = it->second;
+    count = std::min<size_t>(count, CONFIG_SYSTEM_PACKAGE_SERVICE_CURSOR_CHUNK);
+    size_t end = std::min(state.position + count, state.entries.size());
+    chunk->assign(std::make_move_iterator(state.entries.begin() + state.position),
+                  std::make_move_iterator(state.entries.begin() + end));
+    state.position = end;
+    if (state.position == state.entries.size()) {
+        // exhausted, keep the slot until close but give the entries back
+        Entries().swap(state.entries);
+        state.position = 0;
+    }
+    state.lastUsed = ++mClock;
+    *fields = state.fields;
+    return true;
+}
+
+bool PackageCursorTable::close(int32_t cursor, pid_t owner) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mCursors.find(cursor);
+    if (it == mCursors.end() || it->second.owner != owner) {
+        return false;
+    }
+    mCursors.erase(it);
+    return true;
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "PackageRegistry.h"
+
+namespace os {
+namespace pm {
+
+/*
+ * Open registry cursors of the chunked enumeration API.
+ *
+ * A cursor pins the registry entries that were published when it was opened,
+ * so every chunk comes from the same snapshot while installs go on. Entries
+ * are handed out and released chunk by chunk. Cursors belong to the calling
+ * pid, and the least recently used one is dropped once the table is full so
+ * a client that dies without closing can't leak them.
+ */
+class PackageCursorTable {
+public:
+    using Entries = std::vector<PackageRegistry::Replacement>;
+    PackageCursorTable();
+    int32_t open(pid_t owner, int32_t fields, Entries entries);
+    /* moves at most count entries out of the cursor, false if it isn't open */
+    bool take(int32_t cursor, pid_t owner, size_t count, int32_t *fields, Entries *chunk);
+    bool close(int32_t cursor, pid_t owner);
+
+private:
+    struct Cursor {
+        pid_t owner;
+        int32_t fields;
+        Entries entries;
+        size_t position;
+        uint64_t lastUsed;
+    };
+
+    std::mutex mLock;
+    std::map<int32_t, Cursor> mCursors;
+    int32_t mNextId;
+    uint64_t mClock;
+}; // class PackageCursorTable
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,421 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageDigest.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utils/Errors.h>
+#include <utils/Log.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#ifdef CONFIG_SYSTEM_PACKAGE_SERVICE_SHA256_HW
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_HAVE_SHA_NI 1
+#elif defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)
+#include <arm_neon.h>
+#define SHA256_HAVE_ARMV8 1
+#endif
+#endif
+
+namespace os {
+namespace pm {
+
+namespace fs = std::filesystem;
+
+alignas(16) static const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+        0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+        0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+        0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+        0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+        0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+        0xc67178f2};
+
+static const uint32_t INITIAL_STATE[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void blocksPortable(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    uint32_t w[64];
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+                    (uint32_t)data[i * 4 + 2] << 8 | data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + K[i] + w[i];
+            uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA256_HAVE_SHA_NI
+__attribute__((target("sha,sse4.1"))) static void blocksShaNi(uint32_t state[8],
+                                                              const uint8_t *data,
+                                                              size_t blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // the instructions keep the state as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+        __m128i abefSave = state0;
+        __m128i cdghSave = state1;
+        __m128i msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), mask);
+        }
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            __m128i wk = _mm_add_epi32(msg[i & 3], _mm_load_si128((const __m128i *)&K[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0e));
+            if (i < 12) {
+                // w[4i+16 .. 4i+19] from the four previous groups
+                __m128i next = _mm_sha256msg1_epu32(msg[i & 3], msg[(i + 1) & 3]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(msg[(i + 3) & 3], msg[(i + 2) & 3], 4));
+                msg[i & 3] = _mm_sha256msg2_epu32(next, msg[(i + 3) & 3]);
+            }
+        }
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static bool cpuHasShaNi() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1)) {
+        return false;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return ebx & (1u << 29);
+}
+#endif
+
+#ifdef SHA256_HAVE_ARMV8
+static void blocksArmv8(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    uint32x4_t state0 = vld1q_u32(&state[0]);
+    uint32x4_t state1 = vld1q_u32(&state[4]);
+
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+        uint32x4_t abcdSave = state0;
+        uint32x4_t efghSave = state1;
+        uint32x4_t msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+        }
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            uint32x4_t wk = vaddq_u32(msg[i & 3], vld1q_u32(&K[i * 4]));
+            if (i < 12) {
+                // w[4i+16 .. 4i+19] from the four previous groups
+                msg[i & 3] = vsha256su1q_u32(vsha256su0q_u32(msg[i & 3], msg[(i + 1) & 3]),
+                                             msg[(i + 2) & 3], msg[(i + 3) & 3]);
+            }
+            uint32x4_t abcd = state0;
+            state0 = vsha256hq_u32(state0, state1, wk);
+            state1 = vsha256h2q_u32(state1, abcd, wk);
+        }
+        state0 = vaddq_u32(state0, abcdSave);
+        state1 = vaddq_u32(state1, efghSave);
+    }
+
+    vst1q_u32(&state[0], state0);
+    vst1q_u32(&state[4], state1);
+}
+#endif
+
+Sha256::Sha256(Backend backend) : mBlocks(blocksPortable), mLength(0), mBufferSize(0) {
+    if (backend == BACKEND_AUTO) {
+        static const Backend best = [] {
+            if (isSupported(BACKEND_SHA_NI)) return BACKEND_SHA_NI;
+            if (isSupported(BACKEND_ARMV8)) return BACKEND_ARMV8;
+            return BACKEND_PORTABLE;
+        }();
+        backend = best;
+    }
+#ifdef SHA256_HAVE_SHA_NI
+    if (backend == BACKEND_SHA_NI && isSupported(backend)) mBlocks = blocksShaNi;
+#endif
+#ifdef SHA256_HAVE_ARMV8
+    if (backend == BACKEND_ARMV8) mBlocks = blocksArmv8;
+#endif
+    memcpy(mState, INITIAL_STATE, sizeof(mState));
+}
+
+bool Sha256::isSupported(Backend backend) {
+    switch (backend) {
+        case BACKEND_AUTO:
+        case BACKEND_PORTABLE:
+            return true;
+#ifdef SHA256_HAVE_SHA_NI
+        case BACKEND_SHA_NI: {
+            static const bool supported = cpuHasShaNi();
+            return supported;
+        }
+#endif
+#ifdef SHA256_HAVE_ARMV8
+        case BACKEND_ARMV8:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *Sha256::backendName(Backend backend) {
+    switch (backend) {
+        case BACKEND_AUTO:
+            return "auto";
+        case BACKEND_PORTABLE:
+            return "portable";
+        case BACKEND_SHA_NI:
+            return "sha-ni";
+        case BACKEND_ARMV8:
+            return "armv8-ce";
+    }
+    return "unknown";
+}
+
+void Sha256::update(const void *data, size_t size) {
+    const uint8_t *ptr = static_cast<const uint8_t *>(data);
+    mLength += size;
+    if (mBufferSize > 0) {
+        size_t n = std::min(size, SHA256_BLOCK_SIZE - mBufferSize);
+        memcpy(mBuffer + mBufferSize, ptr, n);
+        mBufferSize += n;
+        ptr += n;
+        size -= n;
+        if (mBufferSize < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        mBlocks(mState, mBuffer, 1);
+        mBufferSize = 0;
+    }
+    // whole blocks go straight from the caller's buffer
+    size_t blocks = size / SHA256_BLOCK_SIZE;
+    if (blocks > 0) {
+        mBlocks(mState, ptr, blocks);
+        ptr += blocks * SHA256_BLOCK_SIZE;
+        size -= blocks * SHA256_BLOCK_SIZE;
+    }
+    memcpy(mBuffer, ptr, size);
+    mBufferSize = size;
+}
+
+void Sha256::finish(uint8_t digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bits = mLength * 8;
+    uint8_t padding[SHA256_BLOCK_SIZE * 2] = {0x80};
+    size_t padSize = (mBufferSize < 56 ? 56 : 120) - mBufferSize;
+    for (int i = 0; i < 8; i++) {
+        padding[padSize + i] = bits >> (56 - i * 8);
+    }
+    update(padding, padSize + 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = mState[i] >> 24;
+        digest[i * 4 + 1] = mState[i] >> 16;
+        digest[i * 4 + 2] = mState[i] >> 8;
+        digest[i * 4 + 3] = mState[i];
+    }
+}
+
+std::string Sha256::toHex(const uint8_t digest[SHA256_DIGEST_SIZE]) {
+    static const char hex[] = "0123456789abcdef";
+    std::string out(SHA256_DIGEST_SIZE * 2, '0');
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        out[i * 2] = hex[digest[i] >> 4];
+        out[i * 2 + 1] = hex[digest[i] & 0xf];
+    }
+    return out;
+}
+
+struct DigestEntry {
+    char type; /* 'd'irectory, 'f'ile or 'l'ink */
+    std::string relative;
+    uint64_t size;
+};
+
+static int listDirectory(const fs::path &root, const std::string &relative,
+                         std::vector<DigestEntry> *entries) {
+    std::error_code ec;
+    std::vector<std::string> names;
+    for (const auto &entry : fs::directory_iterator(root / relative, ec)) {
+        names.push_back(entry.path().filename().string());
+    }
+    if (ec) {
+        ALOGE("list %s failed:%s", (root / relative).c_str(), ec.message().c_str());
+        return android::NAME_NOT_FOUND;
+    }
+    std::sort(names.begin(), names.end());
+
+    for (const auto &name : names) {
+        std::string child = relative.empty() ? name : relative + "/" + name;
+        fs::file_status status = fs::symlink_status(root / child, ec);
+        if (ec) return android::NAME_NOT_FOUND;
+        if (fs::is_symlink(status)) {
+            entries->push_back({'l', child, 0});
+        } else if (fs::is_directory(status)) {
+            entries->push_back({'d', child, 0});
+            int ret = listDirectory(root, child, entries);
+            if (ret) return ret;
+        } else if (fs::is_regular_file(status)) {
+            entries->push_back({'f', child, fs::file_size(root / child, ec)});
+            if (ec) return android::NAME_NOT_FOUND;
+        }
+    }
+    return 0;
+}
+
+static int hashFile(Sha256 *sha, const std::string &path, std::vector<uint8_t> *buffer,
+                    const std::function<void(size_t)> &onRead) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("open %s failed:%d", path.c_str(), errno);
+        return android::NAME_NOT_FOUND;
+    }
+    while (true) {
+        ssize_t n = read(fd, buffer->data(), buffer->size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ALOGE("read %s failed:%d", path.c_str(), errno);
+            close(fd);
+            return android::UNKNOWN_ERROR;
+        }
+        if (n == 0) break;
+        sha->update(buffer->data(), n);
+        onRead(n);
+    }
+    close(fd);
+    return 0;
+}
+
+int sha256Path(const char *path, uint8_t digest[SHA256_DIGEST_SIZE], int64_t *size,
+               const std::function<void(int64_t done, int64_t total)> &onProgress) {
+    std::error_code ec;
+    fs::file_status status = fs::status(path, ec);
+    if (ec) {
+        ALOGE("stat %s failed:%s", path, ec.message().c_str());
+        return android::NAME_NOT_FOUND;
+    }
+
+    // list first, so the total is known before any content is read
+    std::vector<DigestEntry> entries;
+    int ret = 0;
+    if (fs::is_directory(status)) {
+        ret = listDirectory(path, "", &entries);
+    } else {
+        entries.push_back({'f', "", fs::file_size(path, ec)});
+    }
+    if (ret) return ret;
+    int64_t total = 0;
+    for (const auto &entry : entries) {
+        total += entry.size;
+    }
+
+    // read in large chunks from the heap, task stacks are small
+    std::vector<uint8_t> buffer(16 * 1024);
+    int64_t done = 0;
+    auto onRead = [&](size_t n) {
+        done += n;
+        if (onProgress) onProgress(done, total);
+    };
+    Sha256 sha;
+    for (const auto &entry : entries) {
+        if (entry.relative.empty()) {
+            // a single archive hashes to the digest of its content
+            ret = hashFile(&sha, path, &buffer, onRead);
+            break;
+        }
+        sha.update(&entry.type, 1);
+        sha.update(entry.relative.c_str(), entry.relative.length() + 1);
+        fs::path full = fs::path(path) / entry.relative;
+        if (entry.type == 'l') {
+            std::string target = fs::read_symlink(full, ec).string();
+            sha.update(target.c_str(), target.length() + 1);
+        } else if (entry.type == 'f') {
+            uint8_t sizeBytes[8];
+            for (int i = 0; i < 8; i++) {
+                sizeBytes[i] = entry.size >> (56 - i * 8);
+            }
+            sha.update(sizeBytes, sizeof(sizeBytes));
+            ret = hashFile(&sha, full.string(), &buffer, onRead);
+        }
+        if (ret) return ret;
+    }
+    if (ret) return ret;
+    sha.finish(digest);
+    if (size) {
+        *size = total;
+    }
+    return 0;
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+
+namespace os {
+namespace pm {
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+/*
+ * Streaming SHA-256.
+ *
+ * The block function is picked once per process: x86 SHA-NI when the CPU
+ * reports it, the ARMv8 crypto extension when the toolchain targets it, the
+ * portable C++ rounds otherwise.
+ */
+class Sha256 {
+public:
+    enum Backend { BACKEND_AUTO = 0, BACKEND_PORTABLE, BACKEND_SHA_NI, BACKEND_ARMV8 };
+
+    explicit Sha256(Backend backend = BACKEND_AUTO);
+    void update(const void *data, size_t size);
+    void finish(uint8_t digest[SHA256_DIGEST_SIZE]);
+    static bool isSupported(Backend backend);
+    static const char *backendName(Backend backend);
+    static std::string toHex(const uint8_t digest[SHA256_DIGEST_SIZE]);
+
+private:
+    using BlockFunc = void (*)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+    BlockFunc mBlocks;
+    uint32_t mState[8];
+    uint64_t mLength;
+    uint8_t mBuffer[SHA256_BLOCK_SIZE];
+    size_t mBufferSize;
+}; // class Sha256
+
+/*
+ * Digest of a package archive or an unpacked package directory.
+ *
+ * A regular file hashes to the SHA-256 of its content. A directory hashes
+ * its entries in byte order of their relative paths, each as a type tag,
+ * the path and, for files, the size and content, so the digest doesn't
+ * depend on the order the filesystem lists them.
+ * The content is read once, size receives the total bytes of regular files and
+ * onProgress follows the bytes read so far.
+ */
+int sha256Path(const char *path, uint8_t digest[SHA256_DIGEST_SIZE], int64_t *size = nullptr,
+               const std::function<void(int64_t done, int64_t total)> &onProgress = nullptr);
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageFlusher.h"
+
+#include <utils/Log.h>
+
+namespace os {
+namespace pm {
+
+PackageFlusher::PackageFlusher(int delayMs, bool threaded)
+      : mDelay(delayMs), mPending(false), mExit(false), mStarted(false) {
+    if (!threaded) {
+        return;
+    }
+    mStarted = createThread(&mThread, "pm_flusher", [this]() { loop(); }) == 0;
+    if (!mStarted) {
+        ALOGW("no flusher thread, registry updates are written synchronously");
+    }
+}
+
+PackageFlusher::~PackageFlusher() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mExit = true;
+    }
+    mCond.notify_all();
+    if (mStarted) {
+        pthread_join(mThread, nullptr);
+    }
+    flush();
+}
+
+size_t PackageFlusher::addTask(std::function<int()> task) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mTasks.push_back({std::move(task), false});
+    return mTasks.size() - 1;
+}
+
+void PackageFlusher::schedule(size_t task) {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mTasks[task].dirty = true;
+        if (mPending) {
+            // the deadline of the first update bounds the latency of the whole burst
+            return;
+        }
+        mPending = true;
+        mDeadline = std::chrono::steady_clock::now() + mDelay;
+    }
+    if (!mStarted) {
+        flush();
+        return;
+    }
+    mCond.notify_all();
+}
+
+int PackageFlusher::flush() {
+    std::lock_guard<std::mutex> runLock(mRunLock);
+    std::vector<std::function<int()>> dirty;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        for (auto &task : mTasks) {
+            if (task.dirty) {
+                task.dirty = false;
+                dirty.push_back(task.func);
+            }
+        }
+        mPending = false;
+    }
+
+    int ret = 0;
+    for (const auto &func : dirty) {
+        int err = func();
+        if (err) {
+            ALOGE("flush registry failed:%d", err);
+            ret = err;
+        }
+    }
+    return ret;
+}
+
+void PackageFlusher::loop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        if (!mPending) {
+            if (mExit) break;
+            mCond.wait(lock);
+            continue;
+        }
+        if (!mExit && std::chrono::steady_clock::now() < mDeadline) {
+            mCond.wait_until(lock, mDeadline);
+            continue;
+        }
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "PackageUtils.h"
+
+namespace os {
+namespace pm {
+
+/*
+ * Background writer for the package registry files.
+ *
+ * Owners register a write task once and mark it dirty after each update. A
+ * dirty task runs on the flusher thread at most delayMs after it was first
+ * marked, so a burst of updates costs a single write.
+ */
+class PackageFlusher {
+public:
+    /* Without a thread, or when it fails to start, schedule() runs the tasks inline. */
+    explicit PackageFlusher(int delayMs, bool threaded = true);
+    ~PackageFlusher();
+    /* Tasks must be added before the first schedule(). */
+    size_t addTask(std::function<int()> task);
+    void schedule(size_t task);
+    /* Run every dirty task now on the calling thread. */
+    int flush();
+
+private:
+    struct Task {
+        std::function<int()> func;
+        bool dirty;
+    };
+    void loop();
+
+    std::chrono::milliseconds mDelay;
+    std::mutex mLock;
+    std::mutex mRunLock; /* keeps task runs in order */
+    std::condition_variable mCond;
+    std::vector<Task> mTasks;
+    bool mPending;
+    std::chrono::steady_clock::time_point mDeadline;
+    bool mExit;
+    pthread_t mThread;
+    bool mStarted;
+}; // class PackageFlusher
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageGeneration.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utils/Errors.h>
+#include <utils/Log.h>
+
+namespace os {
+namespace pm {
+
+PackageGeneration::PackageGeneration() : mShared(nullptr) {
+    mLocal.magic = PACKAGE_GENERATION_MAGIC;
+    mLocal.generation = PACKAGE_GENERATION_UNKNOWN;
+}
+
+PackageGeneration::~PackageGeneration() {
+    unmap();
+}
+
+void PackageGeneration::unmap() {
+    if (mShared && mShared != &mLocal) {
+        munmap(mShared, sizeof(Shared));
+    }
+    mShared = nullptr;
+}
+
+int PackageGeneration::create() {
+    unmap();
+    mShared = &mLocal;
+    int fd = shm_open(PACKAGE_GENERATION_SHM, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ALOGW("create %s failed:%d, generation is local only", PACKAGE_GENERATION_SHM, errno);
+    } else {
+        void *addr = MAP_FAILED;
+        if (ftruncate(fd, sizeof(Shared)) == 0) {
+            addr = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (addr == MAP_FAILED) {
+            ALOGW("map %s failed:%d, generation is local only", PACKAGE_GENERATION_SHM, errno);
+        } else {
+            mShared = static_cast<Shared *>(addr);
+        }
+    }
+
+    if (mShared->magic != PACKAGE_GENERATION_MAGIC) {
+        mShared->generation = PACKAGE_GENERATION_UNKNOWN;
+        mShared->magic = PACKAGE_GENERATION_MAGIC;
+    }
+    // the registry was just rebuilt, whatever clients cached before is stale
+    bump();
+    return mShared == &mLocal ? android::NO_INIT : 0;
+}
+
+int PackageGeneration::attach() {
+    if (mShared) {
+        return 0;
+    }
+    int fd = shm_open(PACKAGE_GENERATION_SHM, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return android::NAME_NOT_FOUND;
+    }
+    void *addr = mmap(nullptr, sizeof(Shared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        ALOGW("map %s failed:%d", PACKAGE_GENERATION_SHM, errno);
+        return android::PERMISSION_DENIED;
+    }
+    mShared = static_cast<Shared *>(addr);
+    if (mShared->magic != PACKAGE_GENERATION_MAGIC) {
+        unmap();
+        return android::BAD_VALUE;
+    }
+    return 0;
+}
+
+uint32_t PackageGeneration::get() const {
+    return mShared ? mShared->generation.load(std::memory_order_acquire)
+                   : PACKAGE_GENERATION_UNKNOWN;
+}
+
+uint32_t PackageGeneration::bump() {
+    uint32_t generation = mShared->generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if (generation == PACKAGE_GENERATION_UNKNOWN) {
+        // wrapped around, never hand out the value clients treat as unknown
+        generation = mShared->generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    }
+    return generation;
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace os {
+namespace pm {
+
+#define PACKAGE_GENERATION_SHM "/package_generation"
+#define PACKAGE_GENERATION_MAGIC 0x4e454750 /* "PGEN" */
+#define PACKAGE_GENERATION_UNKNOWN 0
+
+/*
+ * Registry generation shared with client processes.
+ *
+ * The service bumps it after every install and uninstall. Clients map the
+ * page read-only and compare it with the generation their cached entries
+ * were fetched at, so checking a cache hit costs no binder call. The object
+ * outlives the service, a restarted service keeps counting from where the
+ * old one stopped.
+ */
+class PackageGeneration {
+public:
+    PackageGeneration();
+    ~PackageGeneration();
+    /* service side, counts in process memory when shared memory is unavailable */
+    int create();
+    /* client side, get() returns PACKAGE_GENERATION_UNKNOWN until attached */
+    int attach();
+    uint32_t get() const;
+    uint32_t bump();
+
+private:
+    struct Shared {
+        uint32_t magic;
+        std::atomic<uint32_t> generation;
+    };
+    void unmap();
+
+    Shared *mShared;
+    Shared mLocal;
+}; // class PackageGeneration
+
+} // namespace pm
+} // namespace os
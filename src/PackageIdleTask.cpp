@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageIdleTask.h"
+
+#include <chrono>
+
+#include "PackageUtils.h"
+
+namespace os {
+namespace pm {
+
+PackageIdleTask::PackageIdleTask(int delayMs, std::function<void()> func)
+      : mDelayMs(delayMs), mFunc(std::move(func)), mExit(false) {
+    mStarted = createThread(&mThread, "pm_idle", [this]() { loop(); }) == 0;
+}
+
+PackageIdleTask::~PackageIdleTask() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mExit = true;
+    }
+    mCond.notify_all();
+    if (mStarted) {
+        pthread_join(mThread, nullptr);
+    }
+}
+
+void PackageIdleTask::loop() {
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        if (mCond.wait_for(lock, std::chrono::milliseconds(mDelayMs), [this]() { return mExit; })) {
+            return;
+        }
+    }
+    mFunc();
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <pthread.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+namespace os {
+namespace pm {
+
+/*
+ * Runs a function once on a background thread, delayMs after construction.
+ *
+ * Destruction cancels a run that hasn't started and waits for one in progress.
+ */
+class PackageIdleTask {
+public:
+    PackageIdleTask(int delayMs, std::function<void()> func);
+    ~PackageIdleTask();
+
+private:
+    void loop();
+
+    int mDelayMs;
+    std::function<void()> mFunc;
+    std::mutex mLock;
+    std::condition_variable mCond;
+    bool mExit;
+    pthread_t mThread;
+    bool mStarted;
+}; // class PackageIdleTask
+
+} // namespace pm
+} // namespace os
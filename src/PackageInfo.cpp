@@ -16,6 +16,9 @@
 
 #include "pm/PackageInfo.h"
 
+#include <algorithm>
+
+#include "PackageUtils.h"
 #include "ParcelUtils.h"
 
 namespace os {
@@ -46,7 +49,155 @@ ProcessPriority getProcessPriority(const std::string &str) {
     }
 }
 
+void PackageInfo::assignFields(const PackageInfo &other, int32_t mask) {
+    fields = mask & PACKAGE_FIELD_ALL;
+    encoding = std::min<int32_t>(packageEncoding(mask), PACKAGE_ENCODING_LATEST);
+    packageName = other.packageName;
+    parsedFields = other.parsedFields;
+    if (fields & PACKAGE_FIELD_LABEL) {
+        name = other.name;
+        icon = other.icon;
+    }
+    if (fields & PACKAGE_FIELD_LAUNCH) {
+        entry = other.entry;
+        execfile = other.execfile;
+        priority = other.priority;
+    }
+    if (fields & PACKAGE_FIELD_ACTIVITIES) {
+        activitiesInfo = other.activitiesInfo;
+    }
+    if (fields & PACKAGE_FIELD_SERVICES) {
+        servicesInfo = other.servicesInfo;
+    }
+    if (fields & PACKAGE_FIELD_QUICKAPP) {
+        extra = other.extra;
+    }
+    if (fields & PACKAGE_FIELD_VERSION) {
+        appType = other.appType;
+        version = other.version;
+    }
+    if (fields & PACKAGE_FIELD_INSTALL) {
+        installedPath = other.installedPath;
+        manifest = other.manifest;
+        installTime = other.installTime;
+        userId = other.userId;
+        isSystemUI = other.isSystemUI;
+    }
+    if (fields & PACKAGE_FIELD_STATS) {
+        size = other.size;
+        shasum = other.shasum;
+    }
+}
+
+/*
+ * Set on the leading int32 of a tagged PackageInfo. The untagged layout starts with the
+ * length of packageName, which is never below -1, so a reader tells the two apart.
+ */
+#define PACKAGE_PARCEL_TAG INT32_MIN
+
 android::status_t PackageInfo::readFromParcel(const android::Parcel *parcel) {
+    size_t start = parcel->dataPosition();
+    int32_t header;
+    SAFE_PARCEL(parcel->readInt32, &header);
+    if (header >= -1) {
+        parcel->setDataPosition(start);
+        return readLegacy(parcel);
+    }
+    header &= ~PACKAGE_PARCEL_TAG;
+    fields = header & PACKAGE_FIELD_ALL;
+    encoding = packageEncoding(header);
+    if (encoding == PACKAGE_ENCODING_COMPACT) {
+        return readCompact(parcel);
+    } else if (encoding != PACKAGE_ENCODING_UTF16) {
+        return android::BAD_VALUE;
+    }
+    SAFE_PARCEL(parcel->readUtf8FromUtf16, &packageName);
+    SAFE_PARCEL(parcel->readInt32, &parsedFields);
+    if (fields & PACKAGE_FIELD_LABEL) {
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &name);
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &icon);
+    }
+    if (fields & PACKAGE_FIELD_LAUNCH) {
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &entry);
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &execfile);
+        SAFE_PARCEL(parcel->readInt32, &priority);
+    }
+    if (fields & PACKAGE_FIELD_ACTIVITIES) {
+        SAFE_PARCEL(parcel->readParcelableVector, &activitiesInfo);
+    }
+    if (fields & PACKAGE_FIELD_SERVICES) {
+        SAFE_PARCEL(parcel->readParcelableVector, &servicesInfo);
+    }
+    if (fields & PACKAGE_FIELD_QUICKAPP) {
+        SAFE_PARCEL(parcel->readParcelable, &extra);
+    }
+    if (fields & PACKAGE_FIELD_VERSION) {
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &appType);
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &version);
+    }
+    if (fields & PACKAGE_FIELD_INSTALL) {
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &installedPath);
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &manifest);
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &installTime);
+        SAFE_PARCEL(parcel->readInt32, &userId);
+        SAFE_PARCEL(parcel->readBool, &isSystemUI);
+    }
+    if (fields & PACKAGE_FIELD_STATS) {
+        SAFE_PARCEL(parcel->readInt64, &size);
+        SAFE_PARCEL(parcel->readUtf8FromUtf16, &shasum);
+    }
+    return android::OK;
+}
+
+android::status_t PackageInfo::writeToParcel(android::Parcel *parcel) const {
+    // getPackageInfo and getAllPackageInfo answer older clients in the layout they know
+    if (fields == PACKAGE_FIELD_ALL && encoding == PACKAGE_ENCODING_UTF16) {
+        return writeLegacy(parcel);
+    }
+    SAFE_PARCEL(parcel->writeInt32, PACKAGE_PARCEL_TAG | withPackageEncoding(fields, encoding));
+    if (encoding == PACKAGE_ENCODING_COMPACT) {
+        return writeCompact(parcel);
+    }
+    SAFE_PARCEL(parcel->writeUtf8AsUtf16, packageName);
+    SAFE_PARCEL(parcel->writeInt32, parsedFields);
+    if (fields & PACKAGE_FIELD_LABEL) {
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, name);
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, icon);
+    }
+    if (fields & PACKAGE_FIELD_LAUNCH) {
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, entry);
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, execfile);
+        SAFE_PARCEL(parcel->writeInt32, priority);
+    }
+    if (fields & PACKAGE_FIELD_ACTIVITIES) {
+        SAFE_PARCEL(parcel->writeParcelableVector, activitiesInfo);
+    }
+    if (fields & PACKAGE_FIELD_SERVICES) {
+        SAFE_PARCEL(parcel->writeParcelableVector, servicesInfo);
+    }
+    if (fields & PACKAGE_FIELD_QUICKAPP) {
+        SAFE_PARCEL(parcel->writeNullableParcelable, extra);
+    }
+    if (fields & PACKAGE_FIELD_VERSION) {
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, appType);
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, version);
+    }
+    if (fields & PACKAGE_FIELD_INSTALL) {
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, installedPath);
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, manifest);
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, installTime);
+        SAFE_PARCEL(parcel->writeInt32, userId);
+        SAFE_PARCEL(parcel->writeBool, isSystemUI);
+    }
+    if (fields & PACKAGE_FIELD_STATS) {
+        SAFE_PARCEL(parcel->writeInt64, size);
+        SAFE_PARCEL(parcel->writeUtf8AsUtf16, shasum);
+    }
+    return android::OK;
+}
+
+android::status_t PackageInfo::readLegacy(const android::Parcel *parcel) {
+    bool allValid;
     SAFE_PARCEL(parcel->readUtf8FromUtf16, &packageName);
     SAFE_PARCEL(parcel->readUtf8FromUtf16, &name);
     SAFE_PARCEL(parcel->readBool, &isSystemUI);
@@ -65,11 +216,14 @@ android::status_t PackageInfo::readFromParcel(const android::Parcel *parcel) {
     SAFE_PARCEL(parcel->readInt32, &priority);
     SAFE_PARCEL(parcel->readInt32, &userId);
     SAFE_PARCEL(parcel->readInt64, &size);
-    SAFE_PARCEL(parcel->readBool, &bAllValid);
+    SAFE_PARCEL(parcel->readBool, &allValid);
+    parsedFields = allValid ? PACKAGE_FIELD_MANIFEST : 0;
+    fields = PACKAGE_FIELD_ALL;
+    encoding = PACKAGE_ENCODING_UTF16;
     return android::OK;
 }
 
-android::status_t PackageInfo::writeToParcel(android::Parcel *parcel) const {
+android::status_t PackageInfo::writeLegacy(android::Parcel *parcel) const {
     SAFE_PARCEL(parcel->writeUtf8AsUtf16, packageName);
     SAFE_PARCEL(parcel->writeUtf8AsUtf16, name);
     SAFE_PARCEL(parcel->writeBool, isSystemUI);
@@ -88,7 +242,229 @@ android::status_t PackageInfo::writeToParcel(android::Parcel *parcel) const {
     SAFE_PARCEL(parcel->writeInt32, priority);
     SAFE_PARCEL(parcel->writeInt32, userId);
     SAFE_PARCEL(parcel->writeInt64, size);
-    SAFE_PARCEL(parcel->writeBool, bAllValid);
+    // the old bAllValid, fully parsed or not
+    SAFE_PARCEL(parcel->writeBool, isParsed(PACKAGE_FIELD_MANIFEST));
+    return android::OK;
+}
+
+static android::status_t writeString(android::Parcel *parcel, const std::string &str) {
+    return parcel->writeString8(str.c_str(), str.length());
+}
+
+static android::status_t readString(const android::Parcel *parcel, std::string *str) {
+    size_t length;
+    const char *data = parcel->readString8Inplace(&length);
+    if (data == nullptr) {
+        return android::BAD_VALUE;
+    }
+    str->assign(data, length);
+    return android::OK;
+}
+
+static android::status_t writeStrings(android::Parcel *parcel,
+                                      const std::vector<std::string> &strs) {
+    SAFE_PARCEL(parcel->writeInt32, static_cast<int32_t>(strs.size()));
+    for (const auto &str : strs) {
+        SAFE_PARCEL(writeString, parcel, str);
+    }
+    return android::OK;
+}
+
+/* every element takes at least one int32 on the wire, bound count before allocating */
+static android::status_t readCount(const android::Parcel *parcel, int32_t *count) {
+    SAFE_PARCEL(parcel->readInt32, count);
+    if (*count < 0 || static_cast<size_t>(*count) > parcel->dataAvail() / sizeof(int32_t)) {
+        return android::BAD_VALUE;
+    }
+    return android::OK;
+}
+
+static android::status_t readStrings(const android::Parcel *parcel,
+                                     std::vector<std::string> *strs) {
+    int32_t count;
+    SAFE_PARCEL(readCount, parcel, &count);
+    strs->resize(count);
+    for (auto &str : *strs) {
+        SAFE_PARCEL(readString, parcel, &str);
+    }
+    return android::OK;
+}
+
+static const char *applicationTypeName(ApplicationType type) {
+    switch (type) {
+        case ApplicationType::NATIVE:
+            return "NATIVE";
+        case ApplicationType::QUICKAPP:
+            return "QUICKAPP";
+        default:
+            return nullptr;
+    }
+}
+
+android::status_t PackageInfo::writeCompact(android::Parcel *parcel) const {
+    SAFE_PARCEL(writeString, parcel, packageName);
+    SAFE_PARCEL(parcel->writeInt32, parsedFields);
+    if (fields & PACKAGE_FIELD_LABEL) {
+        SAFE_PARCEL(writeString, parcel, name);
+        SAFE_PARCEL(writeString, parcel, icon);
+    }
+    if (fields & PACKAGE_FIELD_LAUNCH) {
+        SAFE_PARCEL(writeString, parcel, entry);
+        SAFE_PARCEL(writeString, parcel, execfile);
+        SAFE_PARCEL(parcel->writeInt32, priority);
+    }
+    if (fields & PACKAGE_FIELD_ACTIVITIES) {
+        SAFE_PARCEL(parcel->writeInt32, static_cast<int32_t>(activitiesInfo.size()));
+        for (const auto &activity : activitiesInfo) {
+            SAFE_PARCEL(writeString, parcel, activity.name);
+            SAFE_PARCEL(writeString, parcel, activity.launchMode);
+            // the parser defaults taskAffinity to the package name
+            bool ownAffinity = activity.taskAffinity == packageName;
+            SAFE_PARCEL(parcel->writeBool, ownAffinity);
+            if (!ownAffinity) {
+                SAFE_PARCEL(writeString, parcel, activity.taskAffinity);
+            }
+            SAFE_PARCEL(writeStrings, parcel, activity.actions);
+        }
+    }
+    if (fields & PACKAGE_FIELD_SERVICES) {
+        SAFE_PARCEL(parcel->writeInt32, static_cast<int32_t>(servicesInfo.size()));
+        for (const auto &service : servicesInfo) {
+            SAFE_PARCEL(writeString, parcel, service.name);
+            SAFE_PARCEL(parcel->writeBool, service.exported);
+            SAFE_PARCEL(writeStrings, parcel, service.actions);
+            SAFE_PARCEL(writeString, parcel, service.path);
+            SAFE_PARCEL(writeString, parcel, service.type);
+            SAFE_PARCEL(parcel->writeInt32, service.priority);
+        }
+    }
+    if (fields & PACKAGE_FIELD_QUICKAPP) {
+        SAFE_PARCEL(parcel->writeBool, extra.has_value());
+        if (extra) {
+            SAFE_PARCEL(parcel->writeInt32, extra->versionCode);
+            SAFE_PARCEL(writeStrings, parcel, extra->features);
+            SAFE_PARCEL(writeString, parcel, extra->router.entry);
+            SAFE_PARCEL(parcel->writeInt32, static_cast<int32_t>(extra->router.pages.size()));
+            for (const auto &page : extra->router.pages) {
+                SAFE_PARCEL(writeString, parcel, page.pageName);
+            }
+        }
+    }
+    if (fields & PACKAGE_FIELD_VERSION) {
+        // only the bare type names map back, anything else like "QUICKAPP/x" keeps its string
+        ApplicationType type = getApplicationType(appType);
+        if (type != ApplicationType::UNKNOWN && appType != applicationTypeName(type)) {
+            type = ApplicationType::UNKNOWN;
+        }
+        SAFE_PARCEL(parcel->writeInt32, type);
+        if (type == ApplicationType::UNKNOWN) {
+            SAFE_PARCEL(writeString, parcel, appType);
+        }
+        SAFE_PARCEL(writeString, parcel, version);
+    }
+    if (fields & PACKAGE_FIELD_INSTALL) {
+        SAFE_PARCEL(writeString, parcel, installedPath);
+        bool derivedManifest = manifest == joinPath(installedPath, MANIFEST);
+        SAFE_PARCEL(parcel->writeBool, derivedManifest);
+        if (!derivedManifest) {
+            SAFE_PARCEL(writeString, parcel, manifest);
+        }
+        SAFE_PARCEL(writeString, parcel, installTime);
+        SAFE_PARCEL(parcel->writeInt32, userId);
+        SAFE_PARCEL(parcel->writeBool, isSystemUI);
+    }
+    if (fields & PACKAGE_FIELD_STATS) {
+        SAFE_PARCEL(parcel->writeInt64, size);
+        SAFE_PARCEL(writeString, parcel, shasum);
+    }
+    return android::OK;
+}
+
+android::status_t PackageInfo::readCompact(const android::Parcel *parcel) {
+    int32_t count;
+    bool flag;
+    SAFE_PARCEL(readString, parcel, &packageName);
+    SAFE_PARCEL(parcel->readInt32, &parsedFields);
+    if (fields & PACKAGE_FIELD_LABEL) {
+        SAFE_PARCEL(readString, parcel, &name);
+        SAFE_PARCEL(readString, parcel, &icon);
+    }
+    if (fields & PACKAGE_FIELD_LAUNCH) {
+        SAFE_PARCEL(readString, parcel, &entry);
+        SAFE_PARCEL(readString, parcel, &execfile);
+        SAFE_PARCEL(parcel->readInt32, &priority);
+    }
+    if (fields & PACKAGE_FIELD_ACTIVITIES) {
+        SAFE_PARCEL(readCount, parcel, &count);
+        activitiesInfo.resize(count);
+        for (auto &activity : activitiesInfo) {
+            SAFE_PARCEL(readString, parcel, &activity.name);
+            SAFE_PARCEL(readString, parcel, &activity.launchMode);
+            SAFE_PARCEL(parcel->readBool, &flag);
+            if (flag) {
+                activity.taskAffinity = packageName;
+            } else {
+                SAFE_PARCEL(readString, parcel, &activity.taskAffinity);
+            }
+            SAFE_PARCEL(readStrings, parcel, &activity.actions);
+        }
+    }
+    if (fields & PACKAGE_FIELD_SERVICES) {
+        SAFE_PARCEL(readCount, parcel, &count);
+        servicesInfo.resize(count);
+        for (auto &service : servicesInfo) {
+            SAFE_PARCEL(readString, parcel, &service.name);
+            SAFE_PARCEL(parcel->readBool, &service.exported);
+            SAFE_PARCEL(readStrings, parcel, &service.actions);
+            SAFE_PARCEL(readString, parcel, &service.path);
+            SAFE_PARCEL(readString, parcel, &service.type);
+            SAFE_PARCEL(parcel->readInt32, &service.priority);
+        }
+    }
+    if (fields & PACKAGE_FIELD_QUICKAPP) {
+        SAFE_PARCEL(parcel->readBool, &flag);
+        extra.reset();
+        if (flag) {
+            QuickAppInfo &quickapp = extra.emplace();
+            SAFE_PARCEL(parcel->readInt32, &quickapp.versionCode);
+            SAFE_PARCEL(readStrings, parcel, &quickapp.features);
+            SAFE_PARCEL(readString, parcel, &quickapp.router.entry);
+            SAFE_PARCEL(readCount, parcel, &count);
+            quickapp.router.pages.resize(count);
+            for (auto &page : quickapp.router.pages) {
+                SAFE_PARCEL(readString, parcel, &page.pageName);
+            }
+        }
+    }
+    if (fields & PACKAGE_FIELD_VERSION) {
+        int32_t type;
+        SAFE_PARCEL(parcel->readInt32, &type);
+        const char *typeName = applicationTypeName(static_cast<ApplicationType>(type));
+        if (typeName) {
+            appType = typeName;
+        } else if (type == ApplicationType::UNKNOWN) {
+            SAFE_PARCEL(readString, parcel, &appType);
+        } else {
+            return android::BAD_VALUE;
+        }
+        SAFE_PARCEL(readString, parcel, &version);
+    }
+    if (fields & PACKAGE_FIELD_INSTALL) {
+        SAFE_PARCEL(readString, parcel, &installedPath);
+        SAFE_PARCEL(parcel->readBool, &flag);
+        if (flag) {
+            manifest = joinPath(installedPath, MANIFEST);
+        } else {
+            SAFE_PARCEL(readString, parcel, &manifest);
+        }
+        SAFE_PARCEL(readString, parcel, &installTime);
+        SAFE_PARCEL(parcel->readInt32, &userId);
+        SAFE_PARCEL(parcel->readBool, &isSystemUI);
+    }
+    if (fields & PACKAGE_FIELD_STATS) {
+        SAFE_PARCEL(parcel->readInt64, &size);
+        SAFE_PARCEL(readString, parcel, &shasum);
+    }
     return android::OK;
 }
 
@@ -113,7 +489,7 @@ std::string PackageInfo::toString() const {
     os << ", priority: " << ::android::internal::ToString(priority);
     os << ", userId: " << ::android::internal::ToString(userId);
     os << ", size: " << ::android::internal::ToString(size);
-    os << ", bAllValid: " << ::android::internal::ToString(bAllValid);
+    os << ", parsedFields: " << ::android::internal::ToString(parsedFields);
     os << "}";
     return os.str();
 }
@@ -126,7 +502,7 @@ std::string PackageInfo::dumpSimplePackageInfo() {
     oss << "  name: " << name << std::endl;
     oss << "  appType: " << appType << std::endl;
     oss << "  isSystemUI: " << (isSystemUI ? "true" : "false") << std::endl;
-    oss << "  bAllValid: " << (bAllValid ? "true" : "false") << std::endl;
+    oss << "  parsedFields: 0x" << std::hex << parsedFields << std::dec << std::endl;
     oss << "  installPath: " << installedPath << std::endl;
     oss << "  manifest: " << manifest << std::endl;
     oss << "  versionName: " << version << std::endl;
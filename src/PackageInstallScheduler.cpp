@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageInstallScheduler.h"
+
+#include <utils/Log.h>
+
+namespace os {
+namespace pm {
+
+PackageInstallScheduler::PackageInstallScheduler(int maxThreads)
+      : mMaxThreads(maxThreads > 0 ? maxThreads : 1), mIdle(0), mExit(false) {}
+
+PackageInstallScheduler::~PackageInstallScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mExit = true;
+    }
+    mCond.notify_all();
+    for (auto &thread : mThreads) {
+        pthread_join(thread, nullptr);
+    }
+}
+
+void PackageInstallScheduler::post(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(mLock);
+    mQueue.push_back(std::move(task));
+    if (mIdle < static_cast<int>(mQueue.size()) &&
+        static_cast<int>(mThreads.size()) < mMaxThreads) {
+        pthread_t thread;
+        std::string name = "pm_install" + std::to_string(mThreads.size());
+        if (createThread(&thread, name.c_str(), [this]() { loop(); }) == 0) {
+            mThreads.push_back(thread);
+        } else if (mThreads.empty()) {
+            // no worker at all, keep the request working on the caller's thread
+            auto func = std::move(mQueue.back());
+            mQueue.pop_back();
+            lock.unlock();
+            func();
+            return;
+        }
+    }
+    lock.unlock();
+    mCond.notify_one();
+}
+
+void PackageInstallScheduler::loop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        if (mQueue.empty()) {
+            if (mExit) break;
+            mIdle++;
+            mCond.wait(lock);
+            mIdle--;
+            continue;
+        }
+        auto task = std::move(mQueue.front());
+        mQueue.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "PackageUtils.h"
+
+namespace os {
+namespace pm {
+
+/*
+ * Worker pool that runs install requests off the binder threads.
+ *
+ * Requests run in arrival order on up to maxThreads workers, which are
+ * started on demand as the queue grows and kept for later requests.
+ */
+class PackageInstallScheduler {
+public:
+    explicit PackageInstallScheduler(int maxThreads);
+    /* Runs the queued requests to completion before returning. */
+    ~PackageInstallScheduler();
+    void post(std::function<void()> task);
+
+private:
+    void loop();
+
+    int mMaxThreads;
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::deque<std::function<void()>> mQueue;
+    std::vector<pthread_t> mThreads;
+    int mIdle;
+    bool mExit;
+}; // class PackageInstallScheduler
+
+} // namespace pm
+} // namespace os
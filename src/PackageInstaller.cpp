@@ -20,10 +20,21 @@
 #include <utils/Log.h>
 #include <uv_ext.h>
 
+#include <algorithm>
 #include <filesystem>
 
+#include "PackageDigest.h"
+#include "PackageSnapshot.h"
+#include "PackageTrace.h"
 #include "PackageUtils.h"
 
+/* percent of install progress between two onInstallProcess calls */
+#define INSTALL_PROGRESS_STEP 5
+
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_JOURNAL_LIMIT
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_JOURNAL_LIMIT 32
+#endif
+
 namespace os {
 namespace pm {
 
@@ -31,8 +42,24 @@ using std::filesystem::copy;
 using std::filesystem::exists;
 using std::filesystem::temp_directory_path;
 
-PackageInstaller::PackageInstaller() {
+PackageInstaller::PackageInstaller(PackageFlusher *flusher)
+      : mStagingSeq(0),
+        mLoaded(false),
+        mSnapshotDirty(false),
+        mAttributesKnown(true),
+        mJournal(PackageConfig::getInstance().getPackageJournalPath()),
+        mFlusher(flusher) {
     mPackgeListPath = PackageConfig::getInstance().getPackageListPath();
+    mSnapshotPath = PackageConfig::getInstance().getPackageSnapshotPath();
+    mCompactTask = mFlusher->addTask([this]() { return compactPackageList(); });
+    mExportTask = mFlusher->addTask([this]() {
+        std::vector<PackageInfo> pkgInfos;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            pkgInfos = mPkgInfos;
+        }
+        return exportPackageList(pkgInfos);
+    });
 }
 
 int32_t PackageInstaller::createUserId() {
@@ -40,39 +67,47 @@ int32_t PackageInstaller::createUserId() {
     return 0;
 }
 
-int PackageInstaller::installApp(const InstallParam &param) {
+std::string PackageInstaller::createStagingPath(const std::string &packagePath) {
+    size_t pos = packagePath.find_last_of('/');
+    std::string rpkName = pos != std::string::npos ? packagePath.substr(pos + 1) : packagePath;
+    rpkName = rpkName.substr(0, rpkName.rfind('.'));
+
+    // every request gets its own directory, installs of the same file may overlap
+    std::string tmp = joinPath(PackageConfig::getInstance().getAppDataPath(), "tmp");
+    return joinPath(tmp, rpkName + "." + std::to_string(mStagingSeq.fetch_add(1)));
+}
+
+void PackageInstaller::clearStaging() {
+    std::string tmp = joinPath(PackageConfig::getInstance().getAppDataPath(), "tmp");
+    if (exists(tmp.c_str())) {
+        removeDirectory(tmp.c_str());
+    }
+}
+
+int PackageInstaller::installApp(const InstallParam &param, const std::string &staging) {
     size_t pos = param.path.find_last_of('.');
     std::string suffix;
     if (pos != std::string::npos) {
         suffix = param.path.substr(pos + 1);
         if (suffix == "rpk" || suffix == "apk") {
-            return installQuickApp(param);
+            return installQuickApp(param, staging);
         }
     }
-    return installNativeApp(param);
+    return installNativeApp(param, staging);
 }
 
-int PackageInstaller::installNativeApp(const InstallParam &param) {
+int PackageInstaller::installNativeApp(const InstallParam &param, const std::string &staging) {
     // TODO
     return android::INVALID_OPERATION;
 }
 
-int PackageInstaller::installQuickApp(const InstallParam &param) {
-    size_t pos = param.path.find_last_of('/');
-    std::string rpkFullName = param.path;
-    if (pos != std::string::npos) {
-        rpkFullName = param.path.substr(pos + 1);
-    }
-    pos = rpkFullName.rfind('.');
-    std::string rpkName = rpkFullName.substr(0, pos);
-
+int PackageInstaller::installQuickApp(const InstallParam &param, const std::string &staging) {
     if (!exists(param.path.c_str())) {
         ALOGE("%s is not exist", param.path.c_str());
         return android::NAME_NOT_FOUND;
     }
 
-    std::string tmp = joinPath(PackageConfig::getInstance().getAppDataPath(), "tmp");
-    tmp = joinPath(tmp, rpkName);
+    const std::string &tmp = staging;
     if (exists(tmp.c_str())) {
         removeDirectory(tmp.c_str());
     }
@@ -98,50 +133,147 @@ int PackageInstaller::installQuickApp(const InstallParam &param) {
     return 0;
 }
 
+int PackageInstaller::digestPackage(const std::string &path, int64_t *size, std::string *shasum,
+                                    const std::function<void(int32_t)> &onProgress) {
+    // unpacking is the first half of the install, reading the files back the second
+    int32_t reported = 50;
+    onProgress(reported);
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    int ret = sha256Path(path.c_str(), digest, size, [&](int64_t done, int64_t total) {
+        int32_t progress = total > 0 ? 50 + done * 50 / total : 100;
+        if (progress - reported >= INSTALL_PROGRESS_STEP || (progress == 100 && reported < 100)) {
+            reported = progress;
+            onProgress(progress);
+        }
+    });
+    if (ret) {
+        ALOGE("digest %s failed:%d", path.c_str(), ret);
+        return ret;
+    }
+    if (reported < 100) {
+        onProgress(100);
+    }
+    *shasum = Sha256::toHex(digest);
+    return 0;
+}
+
+bool PackageInstaller::hasPackageList() {
+    return exists(mSnapshotPath.c_str()) || exists(mPackgeListPath.c_str());
+}
+
+int PackageInstaller::loadLocked() {
+    if (mLoaded) {
+        return 0;
+    }
+
+    mPkgInfos.clear();
+    mStamps.clear();
+    uint32_t checksum = 0;
+    PackageSnapshot snapshot;
+    if (snapshot.open(mSnapshotPath.c_str()) == 0) {
+        mPkgInfos.reserve(snapshot.count());
+        mStamps.reserve(snapshot.count());
+        for (uint32_t i = 0; i < snapshot.count(); i++) {
+            PackageInfo info;
+            snapshot.getPackageInfo(i, &info);
+            mPkgInfos.push_back(std::move(info));
+            mStamps.push_back(snapshot.getStamp(i));
+        }
+        checksum = snapshot.checksum();
+        mAttributesKnown = snapshot.hasAttributes();
+    } else {
+        // no usable snapshot, import the JSON list and convert it for the next boot.
+        // The JSON list carries no stamps, an incremental scan will reparse these entries.
+        int ret = importPackageList(&mPkgInfos);
+        if (ret) return ret;
+        ALOGI("import %s to %s", mPackgeListPath.c_str(), mSnapshotPath.c_str());
+        mStamps.resize(mPkgInfos.size(), DirectoryStamp{});
+        ret = PackageSnapshot::write(mSnapshotPath.c_str(), mPkgInfos, mStamps, &checksum);
+        if (ret) return ret;
+    }
+
+    int ret = mJournal.replay(checksum, [this](JournalRecord &record) {
+        if (record.op == JOURNAL_ADD && !record.hasAttributes) {
+            mAttributesKnown = false;
+        }
+        applyLocked(record);
+    });
+    if (ret) {
+        // the registry is still usable, mutations fall back to full writes
+        ALOGW("replay journal failed:%d", ret);
+    }
+    mLoaded = true;
+    return 0;
+}
+
+void PackageInstaller::applyLocked(const JournalRecord &record) {
+    for (size_t i = 0; i < mPkgInfos.size(); i++) {
+        if (mPkgInfos[i].packageName == record.info.packageName) {
+            if (record.op == JOURNAL_STATS) {
+                mPkgInfos[i].size = record.info.size;
+                mPkgInfos[i].shasum = record.info.shasum;
+                return;
+            }
+            mPkgInfos.erase(mPkgInfos.begin() + i);
+            mStamps.erase(mStamps.begin() + i);
+            break;
+        }
+    }
+    // an add replaces any entry of the same name, so replaying a record twice is harmless
+    if (record.op == JOURNAL_ADD) {
+        mPkgInfos.push_back(record.info);
+        mStamps.push_back(record.stamp);
+    }
+}
+
+int PackageInstaller::readPackageList(std::vector<PackageInfo> *pkgInfos,
+                                      std::vector<DirectoryStamp> *stamps) {
+    std::lock_guard<std::mutex> lock(mLock);
+    int ret = loadLocked();
+    if (ret) return ret;
+    pkgInfos->insert(pkgInfos->end(), mPkgInfos.begin(), mPkgInfos.end());
+    if (stamps) {
+        stamps->insert(stamps->end(), mStamps.begin(), mStamps.end());
+    }
+    return 0;
+}
+
 bool PackageInstaller::loadPackageList(std::map<std::string, PackageInfo> *pkgInfos) {
     if (pkgInfos == nullptr) {
         return false;
     }
 
-    rapidjson::Document document;
-    int ret = getDocument(mPackgeListPath.c_str(), document);
+    std::vector<PackageInfo> vecPackageInfo;
+    int ret = readPackageList(&vecPackageInfo);
     if (ret) return false;
 
     bool isNormal = true;
-    const rapidjson::Value baseArray = rapidjson::Value(rapidjson::kArrayType);
-    const rapidjson::Value &packagesArray =
-            getValue<const rapidjson::Value &>(document, "packages", baseArray);
-    for (unsigned int i = 0; i < packagesArray.Size(); i++) {
-        PackageInfo info;
-        info.packageName = getValue<std::string>(packagesArray[i], "package", "");
+    for (auto &info : vecPackageInfo) {
         if (info.packageName.empty()) {
             ALOGE("packages.list has package field is empty");
             isNormal = false;
             continue;
         }
-        info.appType = getValue<std::string>(packagesArray[i], "appType", "");
-        info.version = getValue<std::string>(packagesArray[i], "version", "");
-        info.installedPath = getValue<std::string>(packagesArray[i], "installedPath", "");
-        info.manifest = joinPath(info.installedPath, MANIFEST);
-        info.installTime = getValue<std::string>(packagesArray[i], "installedTime", "");
-        info.shasum = getValue<std::string>(packagesArray[i], "shasum", "");
-        info.userId = getValue<int>(packagesArray[i], "uid", 0);
-        info.size = getValue<int64_t>(packagesArray[i], "size", 0);
-        info.bAllValid = false;
-        pkgInfos->insert(std::make_pair(info.packageName, info));
+        pkgInfos->insert(std::make_pair(info.packageName, std::move(info)));
     }
     return isNormal;
 }
 
 int PackageInstaller::createPackageList() {
-    // create file and write
-    rapidjson::Document doc;
-    rapidjson::Document::AllocatorType &allocator = doc.GetAllocator();
-    doc.SetObject();
-    doc.AddMember("version", 1, allocator);
-    rapidjson::Value packages(rapidjson::kArrayType);
-    doc.AddMember("packages", packages, allocator);
-    return writeFile(mPackgeListPath.c_str(), toPrettyString(doc));
+    return createPackageList({}, {});
+}
+
+int PackageInstaller::createPackageList(const std::vector<PackageInfo> &pkgInfos,
+                                        const std::vector<DirectoryStamp> &stamps) {
+    std::unique_lock<std::mutex> lock(mLock);
+    mPkgInfos = pkgInfos;
+    mStamps = stamps;
+    mStamps.resize(mPkgInfos.size(), DirectoryStamp{});
+    mLoaded = true;
+    int ret = writePackageListLocked();
+    lock.unlock();
+    scheduleWrites(false);
+    return ret;
 }
 
 int PackageInstaller::addInfoToPackageList(const PackageInfo &installInfo) {
@@ -150,15 +282,170 @@ int PackageInstaller::addInfoToPackageList(const PackageInfo &installInfo) {
 }
 
 int PackageInstaller::addInfoToPackageList(const std::vector<PackageInfo> &vecPackageInfo) {
+    std::unique_lock<std::mutex> lock(mLock);
+    int ret = loadLocked();
+    if (ret) return ret;
+
+    bool logged = true;
+    for (const auto &info : vecPackageInfo) {
+        JournalRecord record = {JOURNAL_ADD, info, {}};
+        getDirectoryStamp(info.installedPath.c_str(), &record.stamp);
+        applyLocked(record);
+        if (logged && mJournal.appendAdd(info, record.stamp)) {
+            logged = false;
+        }
+    }
+    if (!logged) {
+        ret = writePackageListLocked();
+    }
+    bool compact = mJournal.records() >= CONFIG_SYSTEM_PACKAGE_SERVICE_JOURNAL_LIMIT;
+    lock.unlock();
+    scheduleWrites(compact);
+    return ret;
+}
+
+int PackageInstaller::deleteInfoFromPackageList(const std::string &packageName) {
+    std::unique_lock<std::mutex> lock(mLock);
+    int ret = loadLocked();
+    if (ret) return ret;
+
+    JournalRecord record = {JOURNAL_DELETE, {}, {}};
+    record.info.packageName = packageName;
+    applyLocked(record);
+    if (mJournal.appendDelete(packageName)) {
+        ret = writePackageListLocked();
+    }
+    bool compact = mJournal.records() >= CONFIG_SYSTEM_PACKAGE_SERVICE_JOURNAL_LIMIT;
+    lock.unlock();
+    scheduleWrites(compact);
+    return ret;
+}
+
+int PackageInstaller::updatePackageStats(const std::string &packageName, int64_t size,
+                                         const std::string &shasum) {
+    std::unique_lock<std::mutex> lock(mLock);
+    int ret = loadLocked();
+    if (ret) return ret;
+
+    auto it = std::find_if(mPkgInfos.begin(), mPkgInfos.end(),
+                           [&](const PackageInfo &info) { return info.packageName == packageName; });
+    if (it == mPkgInfos.end()) {
+        return android::NAME_NOT_FOUND;
+    }
+    it->size = size;
+    it->shasum = shasum;
+    // one record per measured package, a full rewrite waits for the journal limit
+    if (mJournal.appendStats(packageName, size, shasum)) {
+        // both can be measured again, so they ride along with the next snapshot write
+        mSnapshotDirty = true;
+    }
+    bool compact = mJournal.records() >= CONFIG_SYSTEM_PACKAGE_SERVICE_JOURNAL_LIMIT;
+    lock.unlock();
+    scheduleWrites(compact);
+    return 0;
+}
+
+bool PackageInstaller::hasPackageAttributes() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (loadLocked()) {
+        // nothing loaded, so nothing to upgrade either
+        return true;
+    }
+    return mAttributesKnown;
+}
+
+int PackageInstaller::updatePackageAttributes(const std::vector<PackageInfo> &pkgInfos) {
+    std::unique_lock<std::mutex> lock(mLock);
+    int ret = loadLocked();
+    if (ret || mAttributesKnown) return ret;
+
+    // a one time format upgrade, the snapshot header records that the attributes are known
+    for (const auto &info : pkgInfos) {
+        auto it = std::find_if(mPkgInfos.begin(), mPkgInfos.end(), [&](const PackageInfo &pkg) {
+            return pkg.packageName == info.packageName;
+        });
+        if (it != mPkgInfos.end()) {
+            it->isSystemUI = info.isSystemUI;
+        }
+    }
+    mAttributesKnown = true;
+    mSnapshotDirty = true;
+    lock.unlock();
+    scheduleWrites(true);
+    return 0;
+}
+
+int PackageInstaller::writePackageListLocked() {
+    uint32_t checksum = 0;
+    int ret = PackageSnapshot::write(mSnapshotPath.c_str(), mPkgInfos, mStamps, &checksum);
+    if (ret) return ret;
+    // the old records are folded into the snapshot and no longer match it
+    mSnapshotDirty = false;
+    if (mJournal.reset(checksum)) {
+        ALOGW("reset journal failed, mutations fall back to full writes");
+    }
+    return 0;
+}
+
+void PackageInstaller::scheduleWrites(bool compact) {
+    // the caller must not hold mLock, the flusher may run the tasks right here
+    if (compact) {
+        mFlusher->schedule(mCompactTask);
+    }
+#ifdef CONFIG_SYSTEM_PACKAGE_SERVICE_LIST_JSON
+    mFlusher->schedule(mExportTask);
+#endif
+}
+
+int PackageInstaller::compactPackageList() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (!mLoaded ||
+        (!mSnapshotDirty && mJournal.records() < CONFIG_SYSTEM_PACKAGE_SERVICE_JOURNAL_LIMIT)) {
+        return 0;
+    }
+    PM_PROFILER_BEGIN();
+    int ret = writePackageListLocked();
+    PM_PROFILER_END();
+    return ret;
+}
+
+int PackageInstaller::importPackageList(std::vector<PackageInfo> *pkgInfos) {
     rapidjson::Document document;
-    int ret = getDocument(mPackgeListPath.c_str(), document);
+    FileBuffer buffer;
+    int ret = getDocument(mPackgeListPath.c_str(), document, &buffer);
     if (ret) return ret;
+
     const rapidjson::Value baseArray = rapidjson::Value(rapidjson::kArrayType);
-    const rapidjson::Value &cpackagesArray =
+    const rapidjson::Value &packagesArray =
             getValue<const rapidjson::Value &>(document, "packages", baseArray);
-    rapidjson::Value &packagesArray = const_cast<rapidjson::Value &>(cpackagesArray);
+    for (unsigned int i = 0; i < packagesArray.Size(); i++) {
+        PackageInfo info;
+        info.packageName = getValue<std::string>(packagesArray[i], "package", "");
+        info.appType = getValue<std::string>(packagesArray[i], "appType", "");
+        info.version = getValue<std::string>(packagesArray[i], "version", "");
+        info.installedPath = getValue<std::string>(packagesArray[i], "installedPath", "");
+        info.manifest = joinPath(info.installedPath, MANIFEST);
+        info.installTime = getValue<std::string>(packagesArray[i], "installedTime", "");
+        info.shasum = getValue<std::string>(packagesArray[i], "shasum", "");
+        info.userId = getValue<int>(packagesArray[i], "uid", 0);
+        info.size = getValue<int64_t>(packagesArray[i], "size", 0);
+        info.isSystemUI = getValue<bool>(packagesArray[i], "isSystemUI", false);
+        if (!packagesArray[i].HasMember("isSystemUI")) {
+            mAttributesKnown = false;
+        }
+        info.parsedFields = 0;
+        pkgInfos->push_back(info);
+    }
+    return 0;
+}
+
+int PackageInstaller::exportPackageList(const std::vector<PackageInfo> &pkgInfos) {
+    rapidjson::Document document;
     rapidjson::Document::AllocatorType &allocator = document.GetAllocator();
-    for (auto &packageInfo : vecPackageInfo) {
+    document.SetObject();
+    document.AddMember("version", 1, allocator);
+    rapidjson::Value packagesArray(rapidjson::kArrayType);
+    for (auto &packageInfo : pkgInfos) {
         rapidjson::Value info(rapidjson::kObjectType);
         rapidjson::Value strval(rapidjson::kStringType);
         info.AddMember("package",
@@ -179,6 +466,7 @@ int PackageInstaller::addInfoToPackageList(const std::vector<PackageInfo> &vecPa
                                         packageInfo.installedPath.length(), allocator),
                        allocator);
         info.AddMember("size", packageInfo.size, allocator);
+        info.AddMember("isSystemUI", packageInfo.isSystemUI, allocator);
         info.AddMember("shasum",
                        strval.SetString(packageInfo.shasum.c_str(), packageInfo.shasum.length(),
                                         allocator),
@@ -189,24 +477,7 @@ int PackageInstaller::addInfoToPackageList(const std::vector<PackageInfo> &vecPa
                        allocator);
         packagesArray.PushBack(info, allocator);
     }
-    return writeFile(mPackgeListPath.c_str(), toPrettyString(document));
-}
-
-int PackageInstaller::deleteInfoFromPackageList(const std::string &packageName) {
-    rapidjson::Document document;
-    int ret = getDocument(mPackgeListPath.c_str(), document);
-    if (ret) return ret;
-    const rapidjson::Value baseArray = rapidjson::Value(rapidjson::kArrayType);
-    const rapidjson::Value &cpackagesArray =
-            getValue<const rapidjson::Value &>(document, "packages", baseArray);
-    rapidjson::Value &packagesArray = const_cast<rapidjson::Value &>(cpackagesArray);
-    for (auto it = packagesArray.Begin(); it != packagesArray.End(); ++it) {
-        std::string pkgName = getValue<std::string>(*it, "package", "");
-        if (packageName == pkgName) {
-            it = packagesArray.Erase(it);
-            break;
-        }
-    }
+    document.AddMember("packages", packagesArray, allocator);
     return writeFile(mPackgeListPath.c_str(), toPrettyString(document));
 }
 
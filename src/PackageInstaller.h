@@ -16,9 +16,14 @@
 
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include <vector>
 
 #include "os/pm/IInstallObserver.h"
+#include "PackageFlusher.h"
+#include "PackageJournal.h"
+#include "PackageUtils.h"
 #include "os/pm/InstallParam.h"
 #include "pm/PackageInfo.h"
 
@@ -27,19 +32,54 @@ namespace pm {
 
 class PackageInstaller {
 public:
-    PackageInstaller();
-    int installApp(const InstallParam& param);
+    explicit PackageInstaller(PackageFlusher* flusher);
+    std::string createStagingPath(const std::string& packagePath);
+    void clearStaging();
+    int installApp(const InstallParam& param, const std::string& staging);
+    int digestPackage(const std::string& path, int64_t* size, std::string* shasum,
+                      const std::function<void(int32_t)>& onProgress);
     int32_t createUserId();
     int createPackageList();
+    int createPackageList(const std::vector<PackageInfo>& pkgInfos,
+                          const std::vector<DirectoryStamp>& stamps);
+    bool hasPackageList();
+    int readPackageList(std::vector<PackageInfo>* pkgInfos,
+                        std::vector<DirectoryStamp>* stamps = nullptr);
     bool loadPackageList(std::map<std::string, PackageInfo>* pkgInfos);
     int addInfoToPackageList(const PackageInfo& installInfo);
     int addInfoToPackageList(const std::vector<PackageInfo>& vecExtraInfo);
     int deleteInfoFromPackageList(const std::string& packageName);
+    int updatePackageStats(const std::string& packageName, int64_t size,
+                           const std::string& shasum);
+    /* False while some entries come from a registry written without their isSystemUI. */
+    bool hasPackageAttributes();
+    int updatePackageAttributes(const std::vector<PackageInfo>& pkgInfos);
 
 private:
-    int installNativeApp(const InstallParam& param);
-    int installQuickApp(const InstallParam& param);
+    int installNativeApp(const InstallParam& param, const std::string& staging);
+    int installQuickApp(const InstallParam& param, const std::string& staging);
+    int loadLocked();
+    void applyLocked(const JournalRecord& record);
+    int writePackageListLocked();
+    void scheduleWrites(bool compact);
+    int compactPackageList();
+    int importPackageList(std::vector<PackageInfo>* pkgInfos);
+    int exportPackageList(const std::vector<PackageInfo>& pkgInfos);
     std::string mPackgeListPath;
+    std::string mSnapshotPath;
+    std::atomic<uint32_t> mStagingSeq;
+
+    /* packages.bin with the journal applied, it's what a reboot would load */
+    std::mutex mLock;
+    bool mLoaded;
+    std::vector<PackageInfo> mPkgInfos;
+    std::vector<DirectoryStamp> mStamps;
+    bool mSnapshotDirty; /* changes kept only in memory until the next compaction */
+    bool mAttributesKnown;
+    PackageJournal mJournal;
+    PackageFlusher* mFlusher;
+    size_t mCompactTask;
+    size_t mExportTask;
 };
 } // namespace pm
 } // namespace os
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageJournal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Errors.h>
+#include <utils/Log.h>
+
+namespace os {
+namespace pm {
+
+struct JournalHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t snapshotChecksum;
+    uint32_t reserved;
+};
+
+static bool decodeRecord(const char *data, size_t size, JournalRecord *record) {
+    ByteReader reader(data, size);
+    if (!reader.readInt32(&record->op)) return false;
+    if (record->op == JOURNAL_DELETE) {
+        return reader.readString(&record->info.packageName);
+    }
+    if (record->op == JOURNAL_STATS) {
+        return reader.readString(&record->info.packageName) &&
+                reader.readInt64(&record->info.size) && reader.readString(&record->info.shasum);
+    }
+    if (record->op != JOURNAL_ADD) return false;
+
+    PackageInfo &info = record->info;
+    int64_t hash;
+    bool ok = reader.readString(&info.packageName) && reader.readString(&info.appType) &&
+            reader.readString(&info.version) && reader.readString(&info.installedPath) &&
+            reader.readString(&info.installTime) && reader.readString(&info.shasum) &&
+            reader.readInt32(&info.userId) && reader.readInt64(&info.size) &&
+            reader.readInt64(&record->stamp.mtime) && reader.readInt64(&record->stamp.inode) &&
+            reader.readInt64(&hash);
+    record->stamp.manifestHash = hash;
+    info.isSystemUI = false;
+    record->hasAttributes = ok && !reader.eof();
+    if (record->hasAttributes) {
+        ok = reader.readBool(&info.isSystemUI);
+    }
+    info.manifest = joinPath(info.installedPath, MANIFEST);
+    info.parsedFields = 0;
+    return ok;
+}
+
+PackageJournal::PackageJournal(const std::string &path) : mPath(path), mFd(-1), mRecords(0) {}
+
+PackageJournal::~PackageJournal() {
+    close();
+}
+
+void PackageJournal::close() {
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+int PackageJournal::replay(uint32_t snapshotChecksum,
+                           const std::function<void(JournalRecord &)> &apply) {
+    std::string content;
+    if (!std::filesystem::exists(mPath) || readFile(mPath.c_str(), content)) {
+        return reset(snapshotChecksum);
+    }
+
+    JournalHeader header;
+    if (content.length() < sizeof(header)) {
+        return reset(snapshotChecksum);
+    }
+    memcpy(&header, content.data(), sizeof(header));
+    if (header.magic != PACKAGE_JOURNAL_MAGIC || header.version != PACKAGE_JOURNAL_VERSION ||
+        header.snapshotChecksum != snapshotChecksum) {
+        // written against another snapshot, its records are already compacted into it
+        ALOGI("journal %s doesn't match the snapshot, drop it", mPath.c_str());
+        return reset(snapshotChecksum);
+    }
+
+    size_t pos = sizeof(header);
+    size_t records = 0;
+    while (content.length() - pos >= 2 * sizeof(uint32_t)) {
+        uint32_t length, crc;
+        memcpy(&length, content.data() + pos, sizeof(length));
+        memcpy(&crc, content.data() + pos + sizeof(length), sizeof(crc));
+        const char *payload = content.data() + pos + 2 * sizeof(uint32_t);
+        if (length > content.length() - pos - 2 * sizeof(uint32_t) ||
+            crc32(payload, length) != crc) {
+            break;
+        }
+        JournalRecord record;
+        if (!decodeRecord(payload, length, &record)) {
+            break;
+        }
+        apply(record);
+        records++;
+        pos += 2 * sizeof(uint32_t) + length;
+    }
+
+    close();
+    mFd = open(mPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (mFd < 0) {
+        ALOGE("open journal %s failed:%d", mPath.c_str(), errno);
+        return android::PERMISSION_DENIED;
+    }
+    if (pos != content.length()) {
+        // torn append from a power cut, drop the partial record
+        ALOGW("journal %s has a broken tail at %zu, truncate it", mPath.c_str(), pos);
+        if (ftruncate(mFd, pos) < 0) {
+            return reset(snapshotChecksum);
+        }
+    }
+    mRecords = records;
+    return 0;
+}
+
+int PackageJournal::reset(uint32_t snapshotChecksum) {
+    close();
+    mRecords = 0;
+    mFd = open(mPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0660);
+    if (mFd < 0) {
+        ALOGE("create journal %s failed:%d", mPath.c_str(), errno);
+        return android::PERMISSION_DENIED;
+    }
+
+    JournalHeader header = {PACKAGE_JOURNAL_MAGIC, PACKAGE_JOURNAL_VERSION, snapshotChecksum, 0};
+    if (!writeFully(mFd, &header, sizeof(header)) ||
+        fsync(mFd) < 0) {
+        ALOGE("write journal %s header failed:%d", mPath.c_str(), errno);
+        close();
+        return android::UNKNOWN_ERROR;
+    }
+    return 0;
+}
+
+int PackageJournal::append(const std::string &payload, bool sync) {
+    if (mFd < 0) {
+        return android::NO_INIT;
+    }
+
+    std::string record;
+    ByteWriter writer(&record);
+    writer.writeInt32(payload.length());
+    writer.writeInt32(crc32(payload.data(), payload.length()));
+    record.append(payload);
+    if (!writeFully(mFd, record.data(), record.length()) || (sync && fsync(mFd) < 0)) {
+        ALOGE("append journal %s failed:%d", mPath.c_str(), errno);
+        return android::UNKNOWN_ERROR;
+    }
+    mRecords++;
+    return 0;
+}
+
+int PackageJournal::appendAdd(const PackageInfo &info, const DirectoryStamp &stamp) {
+    std::string payload;
+    ByteWriter writer(&payload);
+    writer.writeInt32(JOURNAL_ADD);
+    writer.writeString(info.packageName);
+    writer.writeString(info.appType);
+    writer.writeString(info.version);
+    writer.writeString(info.installedPath);
+    writer.writeString(info.installTime);
+    writer.writeString(info.shasum);
+    writer.writeInt32(info.userId);
+    writer.writeInt64(info.size);
+    writer.writeInt64(stamp.mtime);
+    writer.writeInt64(stamp.inode);
+    writer.writeInt64(stamp.manifestHash);
+    writer.writeBool(info.isSystemUI);
+    return append(payload);
+}
+
+int PackageJournal::appendDelete(const std::string &packageName) {
+    std::string payload;
+    ByteWriter writer(&payload);
+    writer.writeInt32(JOURNAL_DELETE);
+    writer.writeString(packageName);
+    return append(payload);
+}
+
+int PackageJournal::appendStats(const std::string &packageName, int64_t size,
+                                const std::string &shasum) {
+    std::string payload;
+    ByteWriter writer(&payload);
+    writer.writeInt32(JOURNAL_STATS);
+    writer.writeString(packageName);
+    writer.writeInt64(size);
+    writer.writeString(shasum);
+    return append(payload, false);
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+
+#include "PackageUtils.h"
+#include "pm/PackageInfo.h"
+
+namespace os {
+namespace pm {
+
+/*
+ * Append-only log of registry mutations, stored next to packages.bin.
+ *
+ * layout: JournalHeader | (length, crc32, payload)*
+ * The header names the snapshot the records apply to. Once the snapshot is
+ * rewritten the journal no longer matches it and its records are dropped,
+ * so a compaction interrupted between the two writes never applies twice.
+ */
+#define PACKAGE_JOURNAL_MAGIC 0x4a4b4750 /* "PGKJ" */
+#define PACKAGE_JOURNAL_VERSION 1
+
+enum JournalOp { JOURNAL_ADD = 1, JOURNAL_DELETE = 2, JOURNAL_STATS = 3 };
+
+struct JournalRecord {
+    int32_t op;
+    /* only packageName is set for JOURNAL_DELETE, and size and shasum for JOURNAL_STATS */
+    PackageInfo info;
+    DirectoryStamp stamp;
+    bool hasAttributes; /* records of older builds end before isSystemUI */
+};
+
+class PackageJournal {
+public:
+    explicit PackageJournal(const std::string &path);
+    ~PackageJournal();
+    int replay(uint32_t snapshotChecksum, const std::function<void(JournalRecord &)> &apply);
+    int reset(uint32_t snapshotChecksum);
+    int appendAdd(const PackageInfo &info, const DirectoryStamp &stamp);
+    int appendDelete(const std::string &packageName);
+    /* Not synced, a lost record only means the package is measured again. */
+    int appendStats(const std::string &packageName, int64_t size, const std::string &shasum);
+    size_t records() const {
+        return mRecords;
+    }
+
+private:
+    int append(const std::string &payload, bool sync = true);
+    void close();
+
+    std::string mPath;
+    int mFd;
+    size_t mRecords;
+}; // class PackageJournal
+
+} // namespace pm
+} // namespace os
@@ -20,7 +20,12 @@
 #include <binder/IServiceManager.h>
 #include <binder/ProcessState.h>
 
+#include <algorithm>
+#include <iterator>
+
+#include "PackageGeneration.h"
 #include "PackageTrace.h"
+#include "PackageUtils.h"
 #include "pm/PackageManagerService.h"
 
 namespace os {
@@ -30,6 +35,14 @@ using namespace android;
 using android::String8;
 using android::binder::Status;
 
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_CLIENT_CACHE_SIZE
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_CLIENT_CACHE_SIZE 16
+#endif
+
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_BATCH_LIMIT
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_BATCH_LIMIT 32
+#endif
+
 #define ASSERT_SERVICE(cond)                                   \
     if (cond) {                                                \
         ALOGE("ServiceManager can't find the service:%s",      \
@@ -37,14 +50,89 @@ using android::binder::Status;
         return DEAD_OBJECT;                                    \
     }
 
-PackageManager::PackageManager() {
+/* ask for the newest PackageInfo encoding, the service falls back to one it knows */
+static int32_t wireFields(int32_t fields) {
+    return withPackageEncoding(fields, PACKAGE_ENCODING_LATEST);
+}
+
+PackageManager::PackageManager()
+      : mGeneration(nullptr), mCacheGeneration(PACKAGE_GENERATION_UNKNOWN) {
     android::getService<IPackageManager>(PackageManagerService::name(), &mService);
 }
 
+PackageManager::~PackageManager() {
+    if (mGeneration) {
+        delete mGeneration;
+        mGeneration = nullptr;
+    }
+}
+
+void PackageManager::setCacheEnabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(mCacheLock);
+    mCache.clear();
+    mCacheOrder.clear();
+    mCacheGeneration = PACKAGE_GENERATION_UNKNOWN;
+    if (!enabled) {
+        delete mGeneration;
+        mGeneration = nullptr;
+    } else if (!mGeneration) {
+        mGeneration = new PackageGeneration();
+        // without the shared counter hits can't be validated, every lookup goes to the service
+        if (mGeneration->attach()) {
+            ALOGW("package generation isn't shared, client cache is off");
+        }
+    }
+}
+
+bool PackageManager::lookupCache(const std::string &packageName, PackageInfo *info) {
+    std::lock_guard<std::mutex> lock(mCacheLock);
+    if (!mGeneration || mGeneration->attach()) {
+        return false;
+    }
+    uint32_t generation = mGeneration->get();
+    if (generation != mCacheGeneration) {
+        mCache.clear();
+        mCacheOrder.clear();
+        mCacheGeneration = generation;
+        return false;
+    }
+    auto it = mCache.find(packageName);
+    if (it == mCache.end()) {
+        return false;
+    }
+    mCacheOrder.splice(mCacheOrder.begin(), mCacheOrder, it->second);
+    *info = *it->second;
+    return true;
+}
+
+void PackageManager::storeCache(uint32_t generation, const PackageInfo &info) {
+    std::lock_guard<std::mutex> lock(mCacheLock);
+    // fetched across an install, the entry may already be stale
+    if (generation == PACKAGE_GENERATION_UNKNOWN || generation != mCacheGeneration) {
+        return;
+    }
+    // the stats land without a generation bump, keep asking until they are measured
+    if (info.size == PACKAGE_SIZE_UNKNOWN) {
+        return;
+    }
+    auto it = mCache.find(info.packageName);
+    if (it != mCache.end()) {
+        *it->second = info;
+        mCacheOrder.splice(mCacheOrder.begin(), mCacheOrder, it->second);
+        return;
+    }
+    if (mCache.size() >= CONFIG_SYSTEM_PACKAGE_SERVICE_CLIENT_CACHE_SIZE) {
+        mCache.erase(mCacheOrder.back().packageName);
+        mCacheOrder.pop_back();
+    }
+    mCacheOrder.push_front(info);
+    mCache[info.packageName] = mCacheOrder.begin();
+}
+
 int32_t PackageManager::getAllPackageInfo(std::vector<PackageInfo> *pkgsInfo) {
     ASSERT_SERVICE(mService == nullptr);
     PM_PROFILER_BEGIN();
-    Status status = mService->getAllPackageInfo(pkgsInfo);
+    Status status = mService->getAllPackageInfoFields(wireFields(PACKAGE_FIELD_ALL), pkgsInfo);
     if (!status.isOk()) {
         ALOGE("getAllPackageInfo failed:%s", status.toString8().c_str());
     }
@@ -55,9 +143,109 @@ int32_t PackageManager::getAllPackageInfo(std::vector<PackageInfo> *pkgsInfo) {
 int32_t PackageManager::getPackageInfo(const std::string &packageName, PackageInfo *info) {
     ASSERT_SERVICE(mService == nullptr);
     PM_PROFILER_BEGIN();
-    Status status = mService->getPackageInfo(packageName, info);
+    if (lookupCache(packageName, info)) {
+        PM_PROFILER_END();
+        return 0;
+    }
+    // read before the call, an install racing with it then invalidates what we store
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mCacheLock);
+        generation = mCacheGeneration;
+    }
+    Status status =
+            mService->getPackageInfoFields(packageName, wireFields(PACKAGE_FIELD_ALL), info);
     if (!status.isOk()) {
         ALOGE("getPackageInfo failed:%s", status.toString8().c_str());
+    } else {
+        storeCache(generation, *info);
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::getAllPackageInfo(int32_t fields, std::vector<PackageInfo> *pkgsInfo) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->getAllPackageInfoFields(wireFields(fields), pkgsInfo);
+    if (!status.isOk()) {
+        ALOGE("getAllPackageInfoFields failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::getPackageInfo(const std::string &packageName, int32_t fields,
+                                       PackageInfo *info) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->getPackageInfoFields(packageName, wireFields(fields), info);
+    if (!status.isOk()) {
+        ALOGE("getPackageInfoFields failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::getPackageInfos(const std::vector<std::string> &packageNames,
+                                        int32_t fields, std::vector<PackageInfo> *pkgsInfo,
+                                        std::vector<int32_t> *statuses) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    pkgsInfo->clear();
+    statuses->clear();
+    // the service takes a bounded batch, larger requests go out in several calls
+    Status status;
+    size_t pos = 0;
+    do {
+        size_t end = std::min<size_t>(packageNames.size(),
+                                      pos + CONFIG_SYSTEM_PACKAGE_SERVICE_BATCH_LIMIT);
+        std::vector<std::string> names(packageNames.begin() + pos, packageNames.begin() + end);
+        std::vector<PackageInfo> chunkInfos;
+        std::vector<int32_t> chunkStatuses;
+        status = mService->getPackageInfos(names, wireFields(fields), &chunkStatuses,
+                                           &chunkInfos);
+        if (!status.isOk()) {
+            ALOGE("getPackageInfos failed:%s", status.toString8().c_str());
+            break;
+        }
+        std::move(chunkInfos.begin(), chunkInfos.end(), std::back_inserter(*pkgsInfo));
+        statuses->insert(statuses->end(), chunkStatuses.begin(), chunkStatuses.end());
+        pos = end;
+    } while (pos < packageNames.size());
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::openPackageCursor(int32_t fields, int32_t *cursor) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->openPackageCursor(wireFields(fields), cursor);
+    if (!status.isOk()) {
+        ALOGE("openPackageCursor failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::fetchPackages(int32_t cursor, int32_t count,
+                                      std::vector<PackageInfo> *pkgsInfo) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->fetchPackages(cursor, count, pkgsInfo);
+    if (!status.isOk()) {
+        ALOGE("fetchPackages failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::closePackageCursor(int32_t cursor) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->closePackageCursor(cursor);
+    if (!status.isOk()) {
+        ALOGE("closePackageCursor failed:%s", status.toString8().c_str());
     }
     PM_PROFILER_END();
     return status.exceptionCode();
@@ -122,6 +310,52 @@ int32_t PackageManager::isFirstBoot(bool *firstBoot) {
     return status.exceptionCode();
 }
 
+int32_t PackageManager::getGeneration(int32_t *generation) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->getGeneration(generation);
+    if (!status.isOk()) {
+        ALOGE("getGeneration failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::getParseFailures(std::vector<ParseFailure> *failures) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->getParseFailures(failures);
+    if (!status.isOk()) {
+        ALOGE("getParseFailures failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::registerPackageChangeObserver(
+        const sp<BnPackageChangeObserver> &observer) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->registerPackageChangeObserver(observer);
+    if (!status.isOk()) {
+        ALOGE("registerPackageChangeObserver failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::unregisterPackageChangeObserver(
+        const sp<BnPackageChangeObserver> &observer) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->unregisterPackageChangeObserver(observer);
+    if (!status.isOk()) {
+        ALOGE("unregisterPackageChangeObserver failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
 int32_t PackageManager::getAllPackageName(std::vector<std::string> *pkgNames) {
     ASSERT_SERVICE(mService == nullptr);
     PM_PROFILER_BEGIN();
@@ -133,5 +367,52 @@ int32_t PackageManager::getAllPackageName(std::vector<std::string> *pkgNames) {
     return status.exceptionCode();
 }
 
+int32_t PackageManager::getPackageNames(const PackageFilter &filter,
+                                        std::vector<std::string> *pkgNames) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->getPackageNames(filter, pkgNames);
+    if (!status.isOk()) {
+        ALOGE("getPackageNames failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::resolveActivity(const std::string &action, ResolveInfo *resolveInfo) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->resolveActivity(action, resolveInfo);
+    if (!status.isOk()) {
+        ALOGE("resolveActivity failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::queryIntentActivities(const std::string &action,
+                                              std::vector<ResolveInfo> *resolveInfos) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->queryIntentActivities(action, resolveInfos);
+    if (!status.isOk()) {
+        ALOGE("queryIntentActivities failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
+int32_t PackageManager::queryIntentServices(const std::string &action,
+                                            std::vector<ResolveInfo> *resolveInfos) {
+    ASSERT_SERVICE(mService == nullptr);
+    PM_PROFILER_BEGIN();
+    Status status = mService->queryIntentServices(action, resolveInfos);
+    if (!status.isOk()) {
+        ALOGE("queryIntentServices failed:%s", status.toString8().c_str());
+    }
+    PM_PROFILER_END();
+    return status.exceptionCode();
+}
+
 } // namespace pm
 } // namespace os
\ No newline at end of file
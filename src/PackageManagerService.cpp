@@ -16,67 +16,218 @@
 
 #include "pm/PackageManagerService.h"
 
+#include <binder/IPCThreadState.h>
 #include <utils/Log.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
 #include <filesystem>
-
+#include <unordered_map>
+
+#include "PackageChangeNotifier.h"
+#include "PackageCursorTable.h"
+#include "PackageFlusher.h"
+#include "PackageGeneration.h"
+#include "PackageIdleTask.h"
+#include "PackageInstallScheduler.h"
 #include "PackageInstaller.h"
 #include "PackageParser.h"
+#include "PackageRegistry.h"
+#include "PackageSizeCache.h"
 #include "PackageTrace.h"
 #include "PackageUtils.h"
 
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_SCAN_THREADS
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_SCAN_THREADS 1
+#endif
+
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_INSTALL_THREADS
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_INSTALL_THREADS 1
+#endif
+
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_FLUSH_DELAY
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_FLUSH_DELAY 0
+#endif
+
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_IDLE_PARSE_DELAY
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_IDLE_PARSE_DELAY 0
+#endif
+
+#ifndef CONFIG_SYSTEM_PACKAGE_SERVICE_BATCH_LIMIT
+#define CONFIG_SYSTEM_PACKAGE_SERVICE_BATCH_LIMIT 32
+#endif
+
 namespace os {
 namespace pm {
 
 namespace fs = std::filesystem;
 
-PackageManagerService::PackageManagerService() : mFirstBoot(false) {
-    mInstaller = new PackageInstaller();
-    mParser = new PackageParser();
+PackageManagerService::PackageManagerService() : mFirstBoot(false), mSettledVersion(UINT64_MAX) {
+    mFlusher = new PackageFlusher(CONFIG_SYSTEM_PACKAGE_SERVICE_FLUSH_DELAY);
+    mInstaller = new PackageInstaller(mFlusher);
+    mParser = new PackageParser(mFlusher);
+    mNotifier = new PackageChangeNotifier(mFlusher);
+    mRegistry = new PackageRegistry();
+    mSizeCache = new PackageSizeCache(
+            [this](const std::string &packageName, int64_t size, const std::string &shasum) {
+                mInstaller->updatePackageStats(packageName, size, shasum);
+                // never wait for a writer, a skipped publish is completed from the cache
+                // by the next reader asking for the stats
+                mRegistry->tryUpdate([&](PackageRegistry::Writer &writer) {
+                    auto entry = writer.find(packageName);
+                    // a reinstall publishes its own stats, never overwrite them
+                    if (!entry || (entry->size != PACKAGE_SIZE_UNKNOWN && !entry->shasum.empty())) {
+                        return;
+                    }
+                    auto info = std::make_shared<PackageInfo>(*entry);
+                    info->size = size;
+                    info->shasum = shasum;
+                    writer.put(info);
+                });
+            });
+    mScheduler = new PackageInstallScheduler(CONFIG_SYSTEM_PACKAGE_SERVICE_INSTALL_THREADS);
+    mCursors = new PackageCursorTable();
+    mGeneration = new PackageGeneration();
     init();
+    mGeneration->create();
+    // the startup scan only read manifest headers, complete the rest before it is asked for
+    mIdleParse = CONFIG_SYSTEM_PACKAGE_SERVICE_IDLE_PARSE_DELAY > 0
+            ? new PackageIdleTask(CONFIG_SYSTEM_PACKAGE_SERVICE_IDLE_PARSE_DELAY,
+                                  [this]() { parsePendingEntries(nullptr); })
+            : nullptr;
 }
 
 PackageManagerService::~PackageManagerService() {
+    if (mIdleParse) {
+        delete mIdleParse;
+        mIdleParse = nullptr;
+    }
+    // finish the queued installs while everything they use is still alive
+    if (mScheduler) {
+        delete mScheduler;
+        mScheduler = nullptr;
+    }
+    if (mSizeCache) {
+        delete mSizeCache;
+        mSizeCache = nullptr;
+    }
+    if (mGeneration) {
+        delete mGeneration;
+        mGeneration = nullptr;
+    }
+    if (mCursors) {
+        delete mCursors;
+        mCursors = nullptr;
+    }
+    if (mRegistry) {
+        delete mRegistry;
+        mRegistry = nullptr;
+    }
+    // pending writes run on the installer and parser, finish them first
+    if (mFlusher) {
+        delete mFlusher;
+        mFlusher = nullptr;
+    }
     if (mParser) {
         delete mParser;
         mParser = nullptr;
     }
+    if (mNotifier) {
+        delete mNotifier;
+        mNotifier = nullptr;
+    }
     if (mInstaller) {
         delete mInstaller;
         mInstaller = nullptr;
     }
 }
 
-void PackageManagerService::init() {
-    PM_PROFILER_BEGIN();
-    auto scanAndGetPackages = [this](const std::vector<std::string> &scanPath) {
-        std::vector<PackageInfo> vecPackageInfo;
-        for (const auto &path : scanPath) {
-            PackageInfo pkgInfo;
-            pkgInfo.manifest = joinPath(path, MANIFEST);
-            int ret = mParser->parseManifest(&pkgInfo);
-            if (!ret) {
-                pkgInfo.userId = mInstaller->createUserId();
-                auto status = mPackageInfo.insert(std::make_pair(pkgInfo.packageName, pkgInfo));
-                if (status.second) {
-                    vecPackageInfo.push_back(pkgInfo);
-                    std::string appDataPath =
-                            joinPath(PackageConfig::getInstance().getAppDataPath(),
-                                     pkgInfo.packageName);
-                    if (!fs::exists(appDataPath.c_str())) {
-                        createDirectory(appDataPath.c_str());
-                    }
-                }
+std::vector<PackageInfo> PackageManagerService::scanPackages(
+        const std::vector<std::string> &scanPath, std::vector<DirectoryStamp> *stamps,
+        bool incremental, std::map<std::string, PackageInfo> *packages) {
+    // an incremental scan takes over the registry entries whose directory is unchanged
+    std::vector<PackageInfo> vecPrevious;
+    std::vector<DirectoryStamp> vecPreviousStamp;
+    std::unordered_map<std::string, size_t> previousIndex;
+    auto pathKey = [](const std::string &path) {
+        // installed packages are recorded without the trailing separator
+        size_t end = path.find_last_not_of('/');
+        return end == std::string::npos ? path : path.substr(0, end + 1);
+    };
+    if (incremental && mInstaller->readPackageList(&vecPrevious, &vecPreviousStamp) == 0) {
+        for (size_t i = 0; i < vecPrevious.size(); i++) {
+            previousIndex.emplace(pathKey(vecPrevious[i].installedPath), i);
+        }
+    }
+
+    // Manifests are independent of each other, parse them on the worker pool and
+    // merge in scan order so the result is the same as a serial scan.
+    std::vector<PackageInfo> vecParsed(scanPath.size());
+    std::vector<DirectoryStamp> vecStamp(scanPath.size());
+    std::vector<int> vecResult(scanPath.size(), android::NO_INIT);
+    std::atomic<size_t> unchanged(0);
+    parallelFor(scanPath.size(), CONFIG_SYSTEM_PACKAGE_SERVICE_SCAN_THREADS, [&](size_t i) {
+        PackageInfo &pkgInfo = vecParsed[i];
+        pkgInfo.manifest = joinPath(scanPath[i], MANIFEST);
+        bool hasStamp = getDirectoryStamp(scanPath[i].c_str(), &vecStamp[i]) == 0;
+        auto it = previousIndex.find(pathKey(scanPath[i]));
+        if (hasStamp && it != previousIndex.end() && vecPreviousStamp[it->second] == vecStamp[i]) {
+            // keep the paths in the form the parser derives them, as a full scan would
+            std::string manifest = pkgInfo.manifest;
+            pkgInfo = vecPrevious[it->second];
+            pkgInfo.manifest = manifest;
+            pkgInfo.installedPath = manifest.substr(0, manifest.length() - strlen(MANIFEST));
+            // files rewritten in place or below the top directory leave the stamp as it was,
+            // measure again like a full scan does
+            pkgInfo.size = PACKAGE_SIZE_UNKNOWN;
+            pkgInfo.shasum.clear();
+            vecResult[i] = 0;
+            unchanged++;
+        } else {
+            // header only, the components are completed on demand or by mIdleParse
+            vecResult[i] = mParser->parseManifest(&pkgInfo, PACKAGE_FIELD_LABEL);
+        }
+        if (!vecResult[i]) {
+            // duplicated packages share the data path of the one that wins the merge
+            std::string appDataPath =
+                    joinPath(PackageConfig::getInstance().getAppDataPath(), pkgInfo.packageName);
+            if (!fs::exists(appDataPath.c_str())) {
+                createDirectory(appDataPath.c_str());
             }
         }
-        return vecPackageInfo;
-    };
+    });
+    if (incremental) {
+        ALOGI("rescan %zu packages, %zu unchanged", scanPath.size(), unchanged.load());
+    }
 
+    std::vector<PackageInfo> vecPackageInfo;
+    for (size_t i = 0; i < vecParsed.size(); i++) {
+        if (vecResult[i]) {
+            continue;
+        }
+        PackageInfo &pkgInfo = vecParsed[i];
+        pkgInfo.userId = mInstaller->createUserId();
+        auto status = packages->insert(std::make_pair(pkgInfo.packageName, pkgInfo));
+        if (status.second) {
+            vecPackageInfo.push_back(pkgInfo);
+            if (stamps) {
+                stamps->push_back(vecStamp[i]);
+            }
+        }
+    }
+    return vecPackageInfo;
+}
+
+void PackageManagerService::init() {
+    PM_PROFILER_BEGIN();
     // create and scan manifest
-    std::string packageListPath = PackageConfig::getInstance().getPackageListPath();
-    if (!fs::exists(packageListPath.c_str())) {
+    std::string packageListPath = PackageConfig::getInstance().getPackageSnapshotPath();
+    std::map<std::string, PackageInfo> packages;
+    // staging left behind by installs interrupted by a reboot
+    mInstaller->clearStaging();
+    if (!mInstaller->hasPackageList()) {
         mFirstBoot = true;
-        mInstaller->createPackageList();
         std::vector<std::string> vecScanPath =
                 getChildDirectories(PackageConfig::getInstance().getAppPresetPath().c_str());
 #ifdef CONFIG_SYSTEM_PACKAGE_SERVICE_DEBUG
@@ -84,45 +235,40 @@ void PackageManagerService::init() {
                 getChildDirectories(PackageConfig::getInstance().getAppInstalledPath().c_str());
         vecScanPath.insert(vecScanPath.begin(), installPath.begin(), installPath.end());
 #endif
-        std::vector<PackageInfo> vecPackageInfo = scanAndGetPackages(vecScanPath);
-        mInstaller->addInfoToPackageList(vecPackageInfo);
+        std::vector<DirectoryStamp> vecStamp;
+        std::vector<PackageInfo> vecPackageInfo =
+                scanPackages(vecScanPath, &vecStamp, false, &packages);
+        mInstaller->createPackageList(vecPackageInfo, vecStamp);
     } else {
 #ifdef CONFIG_SYSTEM_PACKAGE_SERVICE_DEBUG
-        unlink(packageListPath.c_str());
-        mInstaller->createPackageList();
+        // rescan both paths, reparsing only the packages changed since the last registry
         std::vector<std::string> vecScanPath =
                 getChildDirectories(PackageConfig::getInstance().getAppPresetPath().c_str());
         std::vector<std::string> installPath =
                 getChildDirectories(PackageConfig::getInstance().getAppInstalledPath().c_str());
         vecScanPath.insert(vecScanPath.begin(), installPath.begin(), installPath.end());
-        std::vector<PackageInfo> vecPackageInfo = scanAndGetPackages(vecScanPath);
-        mInstaller->addInfoToPackageList(vecPackageInfo);
+        std::vector<DirectoryStamp> vecStamp;
+        std::vector<PackageInfo> vecPackageInfo =
+                scanPackages(vecScanPath, &vecStamp, true, &packages);
+        mInstaller->createPackageList(vecPackageInfo, vecStamp);
 #else
-        auto packagesIsEmpty = [&packageListPath]() {
-            rapidjson::Document document;
-            int ret = getDocument(packageListPath.data(), document);
+        auto packagesIsEmpty = [this, &packageListPath]() {
+            std::vector<PackageInfo> vecPackageInfo;
+            int ret = mInstaller->readPackageList(&vecPackageInfo);
             if (ret) {
                 ALOGE("package list exist:%s, but parse document failed", packageListPath.data());
                 assert(0);
             }
-
-            const auto baseArray = rapidjson::Value(rapidjson::kArrayType);
-            const auto &packagesArray =
-                    getValue<const rapidjson::Value &>(document, "packages", baseArray);
-            return packagesArray.Empty();
+            return vecPackageInfo.empty();
         };
 
         if (packagesIsEmpty()) {
             ALOGI("package list exist:%s, but parse packages empty", packageListPath.data());
-            {
-                fs::path tmppath{packageListPath};
-                fs::remove(tmppath);
-            }
-
             mInstaller->createPackageList();
             std::vector<std::string> vecScanPath =
                     getChildDirectories(PackageConfig::getInstance().getAppPresetPath().data());
-            std::vector<PackageInfo> vecPackageInfo = scanAndGetPackages(vecScanPath);
+            std::vector<PackageInfo> vecPackageInfo =
+                    scanPackages(vecScanPath, nullptr, false, &packages);
             if (packagesIsEmpty()) {
                 ALOGE("reparse packages : %s, but it is empty", packageListPath.data());
                 assert(0);
@@ -130,48 +276,271 @@ void PackageManagerService::init() {
             mInstaller->addInfoToPackageList(vecPackageInfo);
         }
 
-        mInstaller->loadPackageList(&mPackageInfo);
+        mInstaller->loadPackageList(&packages);
 #endif
     }
+    if (!mInstaller->hasPackageAttributes()) {
+        upgradePackageAttributes(&packages);
+    }
+    // published before the size requests, their results are applied to the entries
+    mRegistry->update([&](PackageRegistry::Writer &writer) {
+        for (const auto &[packageName, pkgInfo] : packages) {
+            writer.put(std::make_shared<const PackageInfo>(pkgInfo));
+        }
+    });
+    for (const auto &[packageName, pkgInfo] : packages) {
+        if (pkgInfo.size == PACKAGE_SIZE_UNKNOWN || pkgInfo.shasum.empty()) {
+            mSizeCache->request(packageName, pkgInfo.installedPath);
+        } else {
+            mSizeCache->set(packageName, pkgInfo.size, pkgInfo.shasum);
+        }
+    }
+    mParser->scheduleCacheFlush();
     PM_PROFILER_END();
 }
 
+void PackageManagerService::upgradePackageAttributes(
+        std::map<std::string, PackageInfo> *packages) {
+    // the registry was written by an older build without isSystemUI, read it once
+    std::vector<PackageInfo *> pending;
+    for (auto &[packageName, pkgInfo] : *packages) {
+        if (!pkgInfo.isParsed(PACKAGE_FIELD_LABEL)) {
+            pending.push_back(&pkgInfo);
+        }
+    }
+    ALOGI("upgrade registry attributes of %zu packages", pending.size());
+    parallelFor(pending.size(), CONFIG_SYSTEM_PACKAGE_SERVICE_SCAN_THREADS, [&](size_t i) {
+        PackageInfo pkgInfo = *pending[i];
+        if (mParser->parseManifest(&pkgInfo, PACKAGE_FIELD_LABEL) == 0) {
+            *pending[i] = std::move(pkgInfo);
+        }
+    });
+
+    std::vector<PackageInfo> vecPackageInfo;
+    vecPackageInfo.reserve(packages->size());
+    for (const auto &[packageName, pkgInfo] : *packages) {
+        vecPackageInfo.push_back(pkgInfo);
+    }
+    mInstaller->updatePackageAttributes(vecPackageInfo);
+}
+
+PackageRegistry::Entry PackageManagerService::completeEntry(const PackageRegistry::Entry &entry,
+                                                            int32_t fields) {
+    int32_t missing = fields & PACKAGE_FIELD_MANIFEST & ~entry->parsedFields;
+    int64_t size = PACKAGE_SIZE_UNKNOWN;
+    std::string shasum;
+    if ((fields & PACKAGE_FIELD_STATS) && entry->size == PACKAGE_SIZE_UNKNOWN) {
+        // never walks here, a miss queues the walk and its callback publishes the result
+        size = mSizeCache->get(entry->packageName, entry->installedPath, &shasum);
+    }
+    if (!missing && size == PACKAGE_SIZE_UNKNOWN) {
+        return entry;
+    }
+
+    // published entries are immutable, finish a copy and publish that instead
+    auto info = std::make_shared<PackageInfo>(*entry);
+    if (missing) {
+        if (mParser->parseManifest(info.get(), missing)) {
+            return nullptr;
+        }
+        mParser->scheduleCacheFlush();
+    }
+    if (size != PACKAGE_SIZE_UNKNOWN) {
+        info->size = size;
+        info->shasum = std::move(shasum);
+    }
+    return info;
+}
+
+static std::vector<PackageRegistry::Replacement> listEntries(const PackageRegistry *registry) {
+    auto snapshot = registry->read();
+    std::vector<PackageRegistry::Replacement> entries;
+    entries.reserve(snapshot->size());
+    snapshot->forEach([&](PackageHandle handle, const PackageRegistry::Entry &entry) {
+        entries.push_back({handle, entry, nullptr});
+    });
+    return entries;
+}
+
+static void publishCompleted(PackageRegistry *registry,
+                             std::vector<PackageRegistry::Replacement> entries) {
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [](const PackageRegistry::Replacement &entry) {
+                                     return !entry.desired || entry.desired == entry.expected;
+                                 }),
+                  entries.end());
+    // one publish for the batch, a busy writer only costs the next reader the same work
+    if (!entries.empty()) {
+        registry->tryReplace(entries);
+    }
+}
+
 Status PackageManagerService::getAllPackageInfo(std::vector<PackageInfo> *pkgInfos) {
+    return getAllPackageInfoFields(PACKAGE_FIELD_ALL, pkgInfos);
+}
+
+Status PackageManagerService::getAllPackageInfoFields(int32_t fields,
+                                                      std::vector<PackageInfo> *pkgInfos) {
     PM_PROFILER_BEGIN();
-    for (auto it = mPackageInfo.begin(); it != mPackageInfo.end(); it++) {
-        if (it->second.bAllValid) {
-            ALOGD("getAllPackageInfo:%s", it->second.toString().c_str());
-            pkgInfos->push_back(it->second);
-        } else {
-            int ret = mParser->parseManifest(&it->second);
-            if (!ret) {
-                ALOGD("getAllPackageInfo:%s", it->second.toString().c_str());
-                pkgInfos->push_back(it->second);
-            }
+    std::vector<PackageRegistry::Replacement> entries = listEntries(mRegistry);
+    pkgInfos->reserve(entries.size());
+    // completed outside the read section, publishing waits for readers to leave
+    for (auto &entry : entries) {
+        entry.desired = completeEntry(entry.expected, fields);
+        if (entry.desired) {
+            ALOGD("getAllPackageInfo:%s", entry.desired->toString().c_str());
+            pkgInfos->emplace_back().assignFields(*entry.desired, fields);
         }
     }
+    publishCompleted(mRegistry, std::move(entries));
     PM_PROFILER_END();
     return Status::ok();
 }
 
 Status PackageManagerService::getPackageInfo(const std::string &packageName, PackageInfo *pkgInfo) {
+    return getPackageInfoFields(packageName, PACKAGE_FIELD_ALL, pkgInfo);
+}
+
+Status PackageManagerService::getPackageInfoFields(const std::string &packageName, int32_t fields,
+                                                   PackageInfo *pkgInfo) {
     PM_PROFILER_BEGIN();
-    ALOGD("getPackageInfo package:%s", packageName.c_str());
-    if (mPackageInfo.find(packageName) == mPackageInfo.end()) {
+    ALOGD("getPackageInfo package:%s fields:0x%" PRIx32, packageName.c_str(), fields);
+    PackageRegistry::Replacement entry;
+    entry.expected = mRegistry->find(packageName, &entry.handle);
+    if (!entry.expected) {
         ALOGE("getPackageInfo package:%s can't find", packageName.c_str());
         PM_PROFILER_END();
         return Status::fromExceptionCode(Status::EX_SERVICE_SPECIFIC);
     }
 
-    if (!mPackageInfo[packageName].bAllValid) {
-        int ret = mParser->parseManifest(&mPackageInfo[packageName]);
-        if (ret) {
+    entry.desired = completeEntry(entry.expected, fields);
+    if (!entry.desired) {
+        PM_PROFILER_END();
+        return Status::fromExceptionCode(Status::EX_ILLEGAL_ARGUMENT);
+    }
+    pkgInfo->assignFields(*entry.desired, fields);
+    publishCompleted(mRegistry, {entry});
+    ALOGD("packageInfo: %s", entry.desired->toString().c_str());
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+Status PackageManagerService::getPackageInfos(const std::vector<std::string> &packageNames,
+                                              int32_t fields, std::vector<int32_t> *statuses,
+                                              std::vector<PackageInfo> *pkgInfos) {
+    PM_PROFILER_BEGIN();
+    if (packageNames.size() > CONFIG_SYSTEM_PACKAGE_SERVICE_BATCH_LIMIT) {
+        ALOGE("getPackageInfos %zu names, the limit is %d", packageNames.size(),
+              CONFIG_SYSTEM_PACKAGE_SERVICE_BATCH_LIMIT);
+        PM_PROFILER_END();
+        return Status::fromExceptionCode(Status::EX_ILLEGAL_ARGUMENT);
+    }
+    // a repeated name is completed once, its copies take the result of the first
+    std::vector<size_t> first(packageNames.size());
+    std::unordered_map<std::string_view, size_t> seen;
+    for (size_t i = 0; i < packageNames.size(); i++) {
+        first[i] = seen.emplace(packageNames[i], i).first->second;
+    }
+
+    std::vector<PackageRegistry::Replacement> entries(packageNames.size());
+    {
+        auto snapshot = mRegistry->read();
+        for (size_t i = 0; i < packageNames.size(); i++) {
+            if (first[i] != i) continue;
+            entries[i].handle = snapshot->lookup(packageNames[i]);
+            entries[i].expected = snapshot->get(entries[i].handle);
+        }
+    }
+
+    std::vector<size_t> unparsed;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!entries[i].expected) {
+            continue;
+        }
+        if (!entries[i].expected->isParsed(fields & PACKAGE_FIELD_MANIFEST)) {
+            unparsed.push_back(i);
+        } else {
+            entries[i].desired = completeEntry(entries[i].expected, fields);
+        }
+    }
+    // the manifests the batch is missing are parsed together and published in one go
+    parallelFor(unparsed.size(), CONFIG_SYSTEM_PACKAGE_SERVICE_SCAN_THREADS, [&](size_t i) {
+        auto &entry = entries[unparsed[i]];
+        entry.desired = completeEntry(entry.expected, fields);
+    });
+
+    statuses->resize(packageNames.size());
+    pkgInfos->resize(packageNames.size());
+    for (size_t i = 0; i < packageNames.size(); i++) {
+        PackageInfo &pkgInfo = (*pkgInfos)[i];
+        const PackageRegistry::Replacement &entry = entries[first[i]];
+        if (entry.desired) {
+            pkgInfo.assignFields(*entry.desired, fields);
+            (*statuses)[i] = 0;
+        } else {
+            pkgInfo.packageName = packageNames[i];
+            pkgInfo.parsedFields = 0;
+            pkgInfo.fields = 0;
+            pkgInfo.encoding = std::min<int32_t>(packageEncoding(fields), PACKAGE_ENCODING_LATEST);
+            (*statuses)[i] = entry.expected ? android::BAD_VALUE : android::NAME_NOT_FOUND;
+            ALOGW("getPackageInfos package:%s failed:%" PRIi32, packageNames[i].c_str(),
+                  (*statuses)[i]);
+        }
+    }
+    publishCompleted(mRegistry, std::move(entries));
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+Status PackageManagerService::openPackageCursor(int32_t fields, int32_t *cursor) {
+    PM_PROFILER_BEGIN();
+    pid_t owner = android::IPCThreadState::self()->getCallingPid();
+    // pins the current entries only, manifests are parsed chunk by chunk in fetchPackages
+    *cursor = mCursors->open(owner, fields, listEntries(mRegistry));
+    ALOGD("openPackageCursor pid:%d cursor:%" PRIi32, owner, *cursor);
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+Status PackageManagerService::fetchPackages(int32_t cursor, int32_t count,
+                                            std::vector<PackageInfo> *pkgInfos) {
+    PM_PROFILER_BEGIN();
+    pid_t owner = android::IPCThreadState::self()->getCallingPid();
+    if (count <= 0) {
+        PM_PROFILER_END();
+        return Status::fromExceptionCode(Status::EX_ILLEGAL_ARGUMENT);
+    }
+
+    bool exhausted = false;
+    // an empty reply ends the enumeration, skip chunks whose manifests all failed to parse
+    while (pkgInfos->empty() && !exhausted) {
+        int32_t fields;
+        PackageCursorTable::Entries entries;
+        if (!mCursors->take(cursor, owner, count, &fields, &entries)) {
+            ALOGE("fetchPackages cursor:%" PRIi32 " of pid:%d isn't open", cursor, owner);
             PM_PROFILER_END();
             return Status::fromExceptionCode(Status::EX_ILLEGAL_ARGUMENT);
         }
+        exhausted = entries.empty();
+        pkgInfos->reserve(entries.size());
+        for (auto &entry : entries) {
+            entry.desired = completeEntry(entry.expected, fields);
+            if (entry.desired) {
+                pkgInfos->emplace_back().assignFields(*entry.desired, fields);
+            }
+        }
+        publishCompleted(mRegistry, std::move(entries));
+    }
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+Status PackageManagerService::closePackageCursor(int32_t cursor) {
+    PM_PROFILER_BEGIN();
+    pid_t owner = android::IPCThreadState::self()->getCallingPid();
+    if (!mCursors->close(cursor, owner)) {
+        ALOGW("closePackageCursor cursor:%" PRIi32 " of pid:%d isn't open", cursor, owner);
     }
-    *pkgInfo = mPackageInfo[packageName];
-    ALOGD("packageInfo: %s", pkgInfo->toString().c_str());
     PM_PROFILER_END();
     return Status::ok();
 }
@@ -180,7 +549,7 @@ Status PackageManagerService::clearAppCache(const std::string &packageName, int3
     PM_PROFILER_BEGIN();
     ALOGD("clearAppCache package:%s", packageName.c_str());
     *ret = Status::EX_ILLEGAL_ARGUMENT;
-    if (mPackageInfo.find(packageName) == mPackageInfo.end()) {
+    if (!mRegistry->find(packageName)) {
         ALOGE("clearAppCache package:%s can't find", packageName.c_str());
         PM_PROFILER_END();
         return Status::ok();
@@ -212,24 +581,22 @@ Status PackageManagerService::clearAppCache(const std::string &packageName, int3
 
 Status PackageManagerService::installPackage(const InstallParam &param,
                                              const android::sp<IInstallObserver> &observer) {
-    PM_PROFILER_BEGIN();
     ALOGD("installPackage:%s", param.toString().c_str());
-    size_t pos = param.path.find_last_of('/');
-    std::string rpkFullName = param.path;
-    if (pos != std::string::npos) {
-        rpkFullName = param.path.substr(pos + 1);
-    }
-    pos = rpkFullName.rfind('.');
-    std::string rpkName = rpkFullName.substr(0, pos);
-    std::string tmp = joinPath(PackageConfig::getInstance().getAppDataPath(), "tmp");
-    tmp = joinPath(tmp, rpkName);
+    // the call is oneway, run it on the scheduler and free the binder thread at once
+    mScheduler->post([this, param, observer]() { runInstall(param, observer); });
+    return Status::ok();
+}
 
-    int ret = mInstaller->installApp(param);
+void PackageManagerService::runInstall(const InstallParam &param,
+                                       const android::sp<IInstallObserver> &observer) {
+    PM_PROFILER_BEGIN();
+    std::string tmp = mInstaller->createStagingPath(param.path);
+    int ret = mInstaller->installApp(param, tmp);
     if (ret) {
         observer->onInstallResult(param.path, ret, "Failed to deal with rpkpackage");
         ALOGE("decompress %s failed", param.path.c_str());
         PM_PROFILER_END();
-        return Status::fromExceptionCode(Status::EX_ILLEGAL_STATE);
+        return;
     }
 
     PackageInfo packageinfo;
@@ -237,12 +604,30 @@ Status PackageManagerService::installPackage(const InstallParam &param,
     ret = mParser->parseManifest(&packageinfo);
     if (ret) {
         removeDirectory(tmp.c_str());
+        // the staging directory is gone, don't keep its failure around
+        mParser->invalidateCache(packageinfo.manifest);
         ALOGE("parse manifest:%s failed\n", packageinfo.manifest.c_str());
         observer->onInstallResult(packageinfo.packageName, ret, "Failed to parse manifest");
         PM_PROFILER_END();
-        return Status::fromExceptionCode(Status::EX_ILLEGAL_ARGUMENT);
+        return;
+    }
+
+    // the only read of the unpacked files, it yields both the size and the shasum
+    ret = mInstaller->digestPackage(tmp, &packageinfo.size, &packageinfo.shasum,
+                                    [&](int32_t process) {
+                                        observer->onInstallProcess(packageinfo.packageName,
+                                                                   process);
+                                    });
+    if (ret) {
+        removeDirectory(tmp.c_str());
+        mParser->invalidateCache(packageinfo.manifest);
+        observer->onInstallResult(packageinfo.packageName, ret, "Failed to read package");
+        PM_PROFILER_END();
+        return;
     }
 
+    // staging is private to this request, only publishing it needs the lock
+    std::unique_lock<std::mutex> lock(mLock);
     std::string dstPath =
             joinPath(PackageConfig::getInstance().getAppInstalledPath(), packageinfo.packageName);
     if (fs::exists(dstPath.c_str())) {
@@ -252,11 +637,13 @@ Status PackageManagerService::installPackage(const InstallParam &param,
     std::error_code ec;
     fs::rename(tmp.c_str(), dstPath.c_str(), ec);
     if (ec) {
+        removeDirectory(tmp.c_str());
+        mParser->invalidateCache(packageinfo.manifest);
         observer->onInstallResult(packageinfo.packageName, Status::EX_SECURITY,
                                   "Failed to copy file");
         ALOGE("Copy from %s to %s Failed:%s", tmp.c_str(), dstPath.c_str(), ec.message().c_str());
         PM_PROFILER_END();
-        return Status::fromExceptionCode(Status::EX_SECURITY);
+        return;
     }
     std::string appDataPath =
             joinPath(PackageConfig::getInstance().getAppDataPath(), packageinfo.packageName);
@@ -265,28 +652,37 @@ Status PackageManagerService::installPackage(const InstallParam &param,
     }
 
     packageinfo.installedPath = dstPath;
+    mParser->moveCache(packageinfo.manifest, joinPath(dstPath, MANIFEST));
     packageinfo.manifest = joinPath(dstPath, MANIFEST);
-    if (mPackageInfo.find(packageinfo.packageName) != mPackageInfo.end()) {
-        PackageInfo oldPackageInfo = mPackageInfo[packageinfo.packageName];
-        packageinfo.userId = oldPackageInfo.userId;
-        mPackageInfo.erase(packageinfo.packageName);
+    auto oldPackageInfo = mRegistry->find(packageinfo.packageName);
+    if (oldPackageInfo) {
+        packageinfo.userId = oldPackageInfo->userId;
         mInstaller->deleteInfoFromPackageList(packageinfo.packageName);
-        if (oldPackageInfo.installedPath != packageinfo.installedPath) {
-            removeDirectory(oldPackageInfo.installedPath.c_str());
+        if (oldPackageInfo->installedPath != packageinfo.installedPath) {
+            removeDirectory(oldPackageInfo->installedPath.c_str());
         }
     }
-    mPackageInfo.insert(std::make_pair(packageinfo.packageName, packageinfo));
+    mRegistry->update([&](PackageRegistry::Writer &writer) {
+        writer.put(std::make_shared<const PackageInfo>(packageinfo));
+    });
+    // after the publish, a client tagging an entry with the old generation drops it on next use
+    mNotifier->post(oldPackageInfo ? PACKAGE_UPDATED : PACKAGE_ADDED, packageinfo.packageName,
+                    mGeneration->bump());
     mInstaller->addInfoToPackageList(packageinfo);
+    mSizeCache->set(packageinfo.packageName, packageinfo.size, packageinfo.shasum);
+    lock.unlock();
+    mParser->scheduleCacheFlush();
     observer->onInstallResult(packageinfo.packageName, 0, "success");
     PM_PROFILER_END();
-    return Status::ok();
 }
 
 Status PackageManagerService::uninstallPackage(const UninstallParam &param,
                                                const android::sp<IUninstallObserver> &observer) {
     PM_PROFILER_BEGIN();
+    std::lock_guard<std::mutex> lock(mLock);
     ALOGD("uninstallPackage:%s\n", param.toString().c_str());
-    if (mPackageInfo.find(param.packageName) == mPackageInfo.end()) {
+    auto pkgInfo = mRegistry->find(param.packageName);
+    if (!pkgInfo) {
         if (observer) {
             observer->onUninstallResult(param.packageName, android::NAME_NOT_FOUND,
                                         "Not found package");
@@ -296,17 +692,21 @@ Status PackageManagerService::uninstallPackage(const UninstallParam &param,
         return Status::fromExceptionCode(Status::EX_ILLEGAL_ARGUMENT);
     }
 
-    if (!removeDirectory(mPackageInfo[param.packageName].installedPath.c_str())) {
+    if (!removeDirectory(pkgInfo->installedPath.c_str())) {
         if (observer) {
             observer->onUninstallResult(param.packageName, android::PERMISSION_DENIED,
                                         "Delete Directory Failed");
         }
-        ALOGE("Delete Directory:%s Failed", mPackageInfo[param.packageName].installedPath.c_str());
+        ALOGE("Delete Directory:%s Failed", pkgInfo->installedPath.c_str());
         PM_PROFILER_END();
         return Status::fromExceptionCode(Status::EX_UNSUPPORTED_OPERATION);
     }
 
-    mPackageInfo.erase(param.packageName);
+    mParser->invalidateCache(pkgInfo->manifest);
+    mParser->scheduleCacheFlush();
+    mRegistry->update([&](PackageRegistry::Writer &writer) { writer.erase(param.packageName); });
+    mNotifier->post(PACKAGE_REMOVED, param.packageName, mGeneration->bump());
+    mSizeCache->erase(param.packageName);
     mInstaller->deleteInfoFromPackageList(param.packageName);
     if (param.clearCache) {
         removeDirectory(
@@ -322,17 +722,22 @@ Status PackageManagerService::uninstallPackage(const UninstallParam &param,
 Status PackageManagerService::getPackageSizeInfo(const std::string &packageName,
                                                  PackageStats *pkgStats) {
     PM_PROFILER_BEGIN();
-    if (mPackageInfo.find(packageName) == mPackageInfo.end()) {
+    auto pkgInfo = mRegistry->find(packageName);
+    if (!pkgInfo) {
         ALOGE("getPackageSizeInfo package:%s can't find", packageName.c_str());
         PM_PROFILER_END();
         return Status::fromExceptionCode(Status::EX_SERVICE_SPECIFIC);
     }
 
-    PackageInfo pkgInfo = mPackageInfo[packageName];
-    std::string codePath = pkgInfo.installedPath;
     std::string dataPath = joinPath(PackageConfig::getInstance().getAppDataPath(), packageName);
     std::string cachePath = joinPath(dataPath, "cache");
-    pkgStats->codeSize = getDirectorySize(codePath.c_str());
+    pkgStats->codeSize = pkgInfo->size != PACKAGE_SIZE_UNKNOWN
+            ? pkgInfo->size
+            : mSizeCache->get(packageName, pkgInfo->installedPath);
+    if (pkgStats->codeSize == PACKAGE_SIZE_UNKNOWN) {
+        // still queued, PackageStats has no unknown value so walk it here like the data paths
+        pkgStats->codeSize = getDirectorySize(pkgInfo->installedPath.c_str());
+    }
     pkgStats->dataSize = getDirectorySize(dataPath.c_str());
     pkgStats->cacheSize = getDirectorySize(cachePath.c_str());
     PM_PROFILER_END();
@@ -344,20 +749,208 @@ Status PackageManagerService::isFirstBoot(bool *firstBoot) {
     return Status::ok();
 }
 
+android::status_t PackageManagerService::dump(
+        int fd, const android::Vector<android::String16> & /* args */) {
+    std::vector<ParseFailure> failures = mParser->getFailures();
+    dprintf(fd, "parse failures %zu\n", failures.size());
+    for (const auto &failure : failures) {
+        dprintf(fd, "  %s %s error %" PRIi32 " at %s, skipped %" PRIi32 "\n",
+                failure.packageName.c_str(), failure.manifest.c_str(), failure.error,
+                failure.failTime.c_str(), failure.skipped);
+    }
+    return android::OK;
+}
+
+Status PackageManagerService::getParseFailures(std::vector<ParseFailure> *failures) {
+    PM_PROFILER_BEGIN();
+    *failures = mParser->getFailures();
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+Status PackageManagerService::getGeneration(int32_t *generation) {
+    PM_PROFILER_BEGIN();
+    *generation = static_cast<int32_t>(mGeneration->get());
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+Status PackageManagerService::registerPackageChangeObserver(
+        const android::sp<IPackageChangeObserver> &observer) {
+    int ret = mNotifier->registerObserver(observer);
+    if (ret) {
+        ALOGE("registerPackageChangeObserver failed:%d", ret);
+        return Status::fromExceptionCode(Status::EX_ILLEGAL_ARGUMENT);
+    }
+    return Status::ok();
+}
+
+Status PackageManagerService::unregisterPackageChangeObserver(
+        const android::sp<IPackageChangeObserver> &observer) {
+    int ret = mNotifier->unregisterObserver(observer);
+    if (ret) {
+        ALOGW("unregisterPackageChangeObserver failed:%d", ret);
+        return Status::fromExceptionCode(Status::EX_ILLEGAL_ARGUMENT);
+    }
+    return Status::ok();
+}
+
+bool PackageManagerService::isBroken(const PackageInfo &info) {
+    // getAllPackageInfo leaves out what fails to parse, the names follow the recorded failures
+    return !info.isParsed(PACKAGE_FIELD_MANIFEST) && mParser->hasFailure(info.manifest);
+}
+
 Status PackageManagerService::getAllPackageName(std::vector<std::string> *pkgNames) {
     PM_PROFILER_BEGIN();
-    for (auto it = mPackageInfo.begin(); it != mPackageInfo.end(); it++) {
-        if (it->second.bAllValid) {
-            ALOGD("getAllPackageName:%s", it->second.toString().c_str());
-            pkgNames->push_back(it->second.packageName);
+    // served from the registry alone, no manifest is opened for a name
+    auto snapshot = mRegistry->read();
+    pkgNames->reserve(snapshot->size());
+    snapshot->forEach([&](PackageHandle, const PackageRegistry::Entry &entry) {
+        if (!isBroken(*entry)) {
+            pkgNames->push_back(entry->packageName);
+        }
+    });
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+static bool matchesFilter(const PackageInfo &info, const PackageFilter &filter) {
+    if (filter.systemUI != PackageFilter::SYSTEM_UI_ANY &&
+        info.isSystemUI != (filter.systemUI == PackageFilter::SYSTEM_UI_ONLY)) {
+        return false;
+    }
+    if (!filter.appType.empty()) {
+        std::string_view appType(info.appType);
+        if (appType.substr(0, appType.find('/')) != filter.appType) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Status PackageManagerService::getPackageNames(const PackageFilter &filter,
+                                              std::vector<std::string> *pkgNames) {
+    PM_PROFILER_BEGIN();
+    // appType and isSystemUI are kept in the registry, so these never parse either
+    auto snapshot = mRegistry->read();
+    snapshot->forEach([&](PackageHandle, const PackageRegistry::Entry &entry) {
+        if (matchesFilter(*entry, filter) && !isBroken(*entry)) {
+            pkgNames->push_back(entry->packageName);
+        }
+    });
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+void PackageManagerService::parsePendingEntries(
+        std::vector<std::shared_ptr<const PackageInfo>> *unpublished) {
+    std::vector<PackageRegistry::Replacement> entries;
+    uint64_t version;
+    {
+        auto snapshot = mRegistry->read();
+        version = snapshot->version();
+        // only broken manifests are left, each retry would fail the same way
+        if (!snapshot->unparsed() || version == mSettledVersion.load()) return;
+        snapshot->forEach([&](PackageHandle handle, const PackageRegistry::Entry &entry) {
+            if (!entry->isParsed(PACKAGE_FIELD_MANIFEST)) {
+                entries.push_back({handle, entry, nullptr});
+            }
+        });
+    }
+    for (auto &entry : entries) {
+        entry.desired = completeEntry(entry.expected, PACKAGE_FIELD_MANIFEST);
+    }
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [](const PackageRegistry::Replacement &entry) {
+                                     return !entry.desired;
+                                 }),
+                  entries.end());
+    if (entries.empty()) {
+        mSettledVersion.store(version);
+        return;
+    }
+    if (!unpublished) {
+        mRegistry->replace(entries);
+        return;
+    }
+    // never wait for a writer on a binder thread, the caller matches these itself
+    if (!mRegistry->tryReplace(entries)) {
+        for (auto &entry : entries) {
+            unpublished->push_back(std::move(entry.desired));
+        }
+    }
+}
+
+void PackageManagerService::queryIntent(const std::string &action, int32_t kind,
+                                        std::vector<ResolveInfo> *resolveInfos) {
+    std::vector<PackageRegistry::Entry> unpublished;
+    parsePendingEntries(&unpublished);
+    auto snapshot = mRegistry->read();
+    const std::vector<ComponentRef> *components = snapshot->resolve(action);
+    static const std::vector<ComponentRef> none;
+    for (const auto &component : components ? *components : none) {
+        if (component.kind != kind) continue;
+        auto entry = snapshot->get(component.handle);
+        ResolveInfo resolveInfo;
+        resolveInfo.packageName = entry->packageName;
+        if (kind == COMPONENT_ACTIVITY) {
+            resolveInfo.activityInfo = entry->activitiesInfo[component.index];
         } else {
-            int ret = mParser->parseManifest(&it->second);
-            if (!ret) {
-                ALOGD("getAllPackageName:%s", it->second.toString().c_str());
-                pkgNames->push_back(it->second.packageName);
+            resolveInfo.serviceInfo = entry->servicesInfo[component.index];
+        }
+        resolveInfos->push_back(std::move(resolveInfo));
+    }
+    // parsed here but not in the index yet, the next query finds them published
+    auto declares = [&](const std::vector<std::string> &actions) {
+        return std::find(actions.begin(), actions.end(), action) != actions.end();
+    };
+    for (const auto &entry : unpublished) {
+        if (kind == COMPONENT_ACTIVITY) {
+            for (const auto &activity : entry->activitiesInfo) {
+                if (!declares(activity.actions)) continue;
+                ResolveInfo &resolveInfo = resolveInfos->emplace_back();
+                resolveInfo.packageName = entry->packageName;
+                resolveInfo.activityInfo = activity;
+            }
+        } else {
+            for (const auto &service : entry->servicesInfo) {
+                if (!declares(service.actions)) continue;
+                ResolveInfo &resolveInfo = resolveInfos->emplace_back();
+                resolveInfo.packageName = entry->packageName;
+                resolveInfo.serviceInfo = service;
             }
         }
     }
+}
+
+Status PackageManagerService::resolveActivity(const std::string &action,
+                                              ResolveInfo *resolveInfo) {
+    PM_PROFILER_BEGIN();
+    std::vector<ResolveInfo> resolveInfos;
+    queryIntent(action, COMPONENT_ACTIVITY, &resolveInfos);
+    if (resolveInfos.empty()) {
+        ALOGE("resolveActivity action:%s can't find", action.c_str());
+        PM_PROFILER_END();
+        return Status::fromExceptionCode(Status::EX_SERVICE_SPECIFIC);
+    }
+    // several packages may declare the action, the first one in registry order wins
+    *resolveInfo = std::move(resolveInfos.front());
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+Status PackageManagerService::queryIntentActivities(const std::string &action,
+                                                    std::vector<ResolveInfo> *resolveInfos) {
+    PM_PROFILER_BEGIN();
+    queryIntent(action, COMPONENT_ACTIVITY, resolveInfos);
+    PM_PROFILER_END();
+    return Status::ok();
+}
+
+Status PackageManagerService::queryIntentServices(const std::string &action,
+                                                  std::vector<ResolveInfo> *resolveInfos) {
+    PM_PROFILER_BEGIN();
+    queryIntent(action, COMPONENT_SERVICE, resolveInfos);
     PM_PROFILER_END();
     return Status::ok();
 }
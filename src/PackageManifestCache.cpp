@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageManifestCache.h"
+
+#include <utils/Errors.h>
+#include <utils/Log.h>
+
+#include "os/pm/PageInfo.h"
+#include "os/pm/QuickAppInfo.h"
+#include "os/pm/Router.h"
+
+namespace os {
+namespace pm {
+
+static void encodeManifest(const PackageInfo &info, std::string *out) {
+    ByteWriter writer(out);
+    writer.writeString(info.packageName);
+    writer.writeString(info.appType);
+    writer.writeString(info.version);
+    writer.writeString(info.name);
+    writer.writeString(info.icon);
+    writer.writeInt32(info.priority);
+    writer.writeBool(info.isSystemUI);
+    writer.writeString(info.entry);
+    writer.writeString(info.execfile);
+
+    writer.writeInt32(info.activitiesInfo.size());
+    for (const auto &activity : info.activitiesInfo) {
+        writer.writeString(activity.name);
+        writer.writeString(activity.launchMode);
+        writer.writeString(activity.taskAffinity);
+        writer.writeStringVector(activity.actions);
+    }
+
+    writer.writeInt32(info.servicesInfo.size());
+    for (const auto &service : info.servicesInfo) {
+        writer.writeString(service.name);
+        writer.writeBool(service.exported);
+        writer.writeStringVector(service.actions);
+        writer.writeString(service.path);
+        writer.writeString(service.type);
+        writer.writeInt32(service.priority);
+    }
+
+    writer.writeBool(info.extra.has_value());
+    if (info.extra.has_value()) {
+        writer.writeInt32(info.extra->versionCode);
+        writer.writeStringVector(info.extra->features);
+        writer.writeString(info.extra->router.entry);
+        writer.writeInt32(info.extra->router.pages.size());
+        for (const auto &page : info.extra->router.pages) {
+            writer.writeString(page.pageName);
+        }
+    }
+}
+
+static bool decodeManifest(const std::string &payload, PackageInfo *info) {
+    ByteReader reader(payload.data(), payload.length());
+    std::string packageName;
+    if (!reader.readString(&packageName)) return false;
+    if (!info->packageName.empty() && info->packageName != packageName) {
+        // the manifest now belongs to another package, let the parser decide
+        return false;
+    }
+    info->packageName = packageName;
+    bool ok = reader.readString(&info->appType) && reader.readString(&info->version) &&
+            reader.readString(&info->name) && reader.readString(&info->icon) &&
+            reader.readInt32(&info->priority) && reader.readBool(&info->isSystemUI) &&
+            reader.readString(&info->entry) && reader.readString(&info->execfile);
+
+    int32_t count = 0;
+    ok = ok && reader.readInt32(&count);
+    info->activitiesInfo.clear();
+    for (int32_t i = 0; ok && i < count; i++) {
+        ActivityInfo activity;
+        ok = reader.readString(&activity.name) && reader.readString(&activity.launchMode) &&
+                reader.readString(&activity.taskAffinity) &&
+                reader.readStringVector(&activity.actions);
+        info->activitiesInfo.push_back(std::move(activity));
+    }
+
+    ok = ok && reader.readInt32(&count);
+    info->servicesInfo.clear();
+    for (int32_t i = 0; ok && i < count; i++) {
+        ServiceInfo service;
+        ok = reader.readString(&service.name) && reader.readBool(&service.exported) &&
+                reader.readStringVector(&service.actions) && reader.readString(&service.path) &&
+                reader.readString(&service.type) && reader.readInt32(&service.priority);
+        info->servicesInfo.push_back(std::move(service));
+    }
+
+    bool hasExtra = false;
+    ok = ok && reader.readBool(&hasExtra);
+    info->extra.reset();
+    if (ok && hasExtra) {
+        QuickAppInfo quickappInfo;
+        ok = reader.readInt32(&quickappInfo.versionCode) &&
+                reader.readStringVector(&quickappInfo.features) &&
+                reader.readString(&quickappInfo.router.entry) && reader.readInt32(&count);
+        for (int32_t i = 0; ok && i < count; i++) {
+            PageInfo page;
+            ok = reader.readString(&page.pageName);
+            quickappInfo.router.pages.push_back(std::move(page));
+        }
+        info->extra = std::move(quickappInfo);
+    }
+    return ok;
+}
+
+PackageManifestCache::PackageManifestCache(const std::string &path)
+      : mPath(path), mDirty(false) {
+    load();
+}
+
+void PackageManifestCache::load() {
+    std::string content;
+    if (!std::filesystem::exists(mPath) || readFile(mPath.c_str(), content)) {
+        return;
+    }
+
+    ByteReader header(content.data(), content.length());
+    int32_t magic, version, count, checksum;
+    if (!header.readInt32(&magic) || !header.readInt32(&version) || !header.readInt32(&count) ||
+        !header.readInt32(&checksum) || magic != MANIFEST_CACHE_MAGIC ||
+        version != MANIFEST_CACHE_VERSION) {
+        ALOGW("manifest cache %s has unknown format, drop it", mPath.c_str());
+        return;
+    }
+    const char *data = content.data() + header.position();
+    size_t size = content.length() - header.position();
+    if (static_cast<uint32_t>(checksum) != crc32(data, size)) {
+        ALOGW("manifest cache %s is corrupted, drop it", mPath.c_str());
+        return;
+    }
+
+    ByteReader reader(data, size);
+    for (int32_t i = 0; i < count; i++) {
+        std::string manifest;
+        Entry entry;
+        int64_t hash;
+        if (!reader.readString(&manifest) || !reader.readInt64(&entry.stamp.mtime) ||
+            !reader.readInt64(&entry.stamp.size) || !reader.readInt64(&entry.stamp.inode) ||
+            !reader.readInt64(&hash) || !reader.readString(&entry.payload)) {
+            ALOGW("manifest cache %s is truncated", mPath.c_str());
+            mEntries.clear();
+            return;
+        }
+        entry.stamp.hash = hash;
+        mEntries.emplace(std::move(manifest), std::move(entry));
+    }
+}
+
+bool PackageManifestCache::get(const std::string &manifest, const FileStamp &stamp,
+                               PackageInfo *info) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mEntries.find(manifest);
+    if (it == mEntries.end()) {
+        return false;
+    }
+    if (it->second.stamp != stamp) {
+        mEntries.erase(it);
+        mDirty = true;
+        return false;
+    }
+
+    PackageInfo cached;
+    cached.packageName = info->packageName;
+    if (!decodeManifest(it->second.payload, &cached)) {
+        mEntries.erase(it);
+        mDirty = true;
+        return false;
+    }
+    if (info->packageName.empty()) {
+        info->packageName = std::move(cached.packageName);
+        info->appType = std::move(cached.appType);
+        info->version = std::move(cached.version);
+    }
+    info->name = std::move(cached.name);
+    info->icon = std::move(cached.icon);
+    info->priority = cached.priority;
+    info->isSystemUI = cached.isSystemUI;
+    info->entry = std::move(cached.entry);
+    info->execfile = std::move(cached.execfile);
+    info->activitiesInfo = std::move(cached.activitiesInfo);
+    info->servicesInfo = std::move(cached.servicesInfo);
+    info->extra = std::move(cached.extra);
+    return true;
+}
+
+void PackageManifestCache::put(const std::string &manifest, const FileStamp &stamp,
+                               const PackageInfo &info) {
+    Entry entry;
+    entry.stamp = stamp;
+    encodeManifest(info, &entry.payload);
+    std::lock_guard<std::mutex> lock(mLock);
+    mEntries[manifest] = std::move(entry);
+    mDirty = true;
+}
+
+void PackageManifestCache::erase(const std::string &manifest) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mEntries.erase(manifest)) {
+        mDirty = true;
+    }
+}
+
+void PackageManifestCache::move(const std::string &from, const std::string &to) {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto it = mEntries.find(from);
+    if (it == mEntries.end()) {
+        return;
+    }
+    // rename keeps the stamp, so the entry stays valid at the new path
+    Entry entry = std::move(it->second);
+    mEntries.erase(it);
+    mEntries[to] = std::move(entry);
+    mDirty = true;
+}
+
+int PackageManifestCache::flush() {
+    // keep concurrent flushes in order, so an older copy never overwrites a newer one
+    std::lock_guard<std::mutex> flushLock(mFlushLock);
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mDirty) {
+            return 0;
+        }
+        ByteWriter writer(&data);
+        for (const auto &[manifest, entry] : mEntries) {
+            writer.writeString(manifest);
+            writer.writeInt64(entry.stamp.mtime);
+            writer.writeInt64(entry.stamp.size);
+            writer.writeInt64(entry.stamp.inode);
+            writer.writeInt64(entry.stamp.hash);
+            writer.writeString(entry.payload);
+        }
+        std::string header;
+        ByteWriter headerWriter(&header);
+        headerWriter.writeInt32(MANIFEST_CACHE_MAGIC);
+        headerWriter.writeInt32(MANIFEST_CACHE_VERSION);
+        headerWriter.writeInt32(mEntries.size());
+        headerWriter.writeInt32(crc32(data.data(), data.length()));
+        data.insert(0, header);
+        mDirty = false;
+    }
+    return writeFile(mPath.c_str(), data);
+}
+
+} // namespace pm
+} // namespace os
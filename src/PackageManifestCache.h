@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+
+#include "PackageUtils.h"
+#include "pm/PackageInfo.h"
+
+namespace os {
+namespace pm {
+
+#define MANIFEST_CACHE_MAGIC 0x434d4750 /* "PGMC" */
+#define MANIFEST_CACHE_VERSION 1
+
+/*
+ * Persistent cache of parsed manifests, keyed by manifest path and validated
+ * against the stamp (mtime, size, inode and content hash) of the manifest.
+ */
+class PackageManifestCache {
+public:
+    explicit PackageManifestCache(const std::string &path);
+    bool get(const std::string &manifest, const FileStamp &stamp, PackageInfo *info);
+    void put(const std::string &manifest, const FileStamp &stamp, const PackageInfo &info);
+    void erase(const std::string &manifest);
+    void move(const std::string &from, const std::string &to);
+    int flush();
+
+private:
+    struct Entry {
+        FileStamp stamp;
+        std::string payload;
+    };
+
+    void load();
+    std::mutex mLock;
+    std::mutex mFlushLock;
+    std::string mPath;
+    std::unordered_map<std::string, Entry> mEntries;
+    bool mDirty;
+}; // class PackageManifestCache
+
+} // namespace pm
+} // namespace os
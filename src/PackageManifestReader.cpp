@@ -0,0 +1,589 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageManifestReader.h"
+
+#include <limits.h>
+#include <rapidjson/reader.h>
+#include <string.h>
+#include <utils/Errors.h>
+#include <utils/Log.h>
+
+#include <optional>
+
+#include "PackageUtils.h"
+#include "os/pm/PageInfo.h"
+#include "os/pm/QuickAppInfo.h"
+#include "os/pm/Router.h"
+
+namespace os {
+namespace pm {
+
+enum ManifestKey : uint8_t {
+    KEY_NONE,
+    KEY_PACKAGE,
+    KEY_APP_TYPE,
+    KEY_VERSION_NAME,
+    KEY_VERSION_CODE,
+    KEY_NAME,
+    KEY_ICON,
+    KEY_PRIORITY,
+    KEY_SYSTEM_UI,
+    KEY_ENTRY,
+    KEY_EXECFILE,
+    KEY_ACTIVITIES,
+    KEY_SERVICES,
+    KEY_INTENT_FILTER,
+    KEY_FEATURES,
+    KEY_ROUTER,
+    KEY_LAUNCH_MODE,
+    KEY_TASK_AFFINITY,
+    KEY_EXPORTED,
+    KEY_PATH,
+    KEY_TYPE,
+    KEY_ACTIONS,
+    KEY_PAGES,
+    KEY_ELEMENT, /* a new entry of activities, services or features */
+    KEY_ACTION,  /* an entry of intent-filter.actions */
+};
+
+enum class Scope : uint8_t {
+    ROOT,
+    ACTIVITIES,
+    ACTIVITY,
+    SERVICES,
+    SERVICE,
+    INTENT_FILTER,
+    ACTIONS,
+    FEATURES,
+    FEATURE,
+    ROUTER,
+    PAGES,
+    SKIP,
+};
+
+struct FieldEntry {
+    const char *key;
+    uint8_t length;
+    ManifestKey id;
+};
+
+#define MANIFEST_FIELD(key, id) \
+    { key, sizeof(key) - 1, id }
+
+static constexpr FieldEntry ROOT_FIELDS[] = {
+        MANIFEST_FIELD("package", KEY_PACKAGE),
+        MANIFEST_FIELD("appType", KEY_APP_TYPE),
+        MANIFEST_FIELD("versionName", KEY_VERSION_NAME),
+        MANIFEST_FIELD("versionCode", KEY_VERSION_CODE),
+        MANIFEST_FIELD("name", KEY_NAME),
+        MANIFEST_FIELD("icon", KEY_ICON),
+        MANIFEST_FIELD("priority", KEY_PRIORITY),
+        MANIFEST_FIELD("isSystemUI", KEY_SYSTEM_UI),
+        MANIFEST_FIELD("entry", KEY_ENTRY),
+        MANIFEST_FIELD("execfile", KEY_EXECFILE),
+        MANIFEST_FIELD("activities", KEY_ACTIVITIES),
+        MANIFEST_FIELD("services", KEY_SERVICES),
+        MANIFEST_FIELD("intent-filter", KEY_INTENT_FILTER),
+        MANIFEST_FIELD("features", KEY_FEATURES),
+        MANIFEST_FIELD("router", KEY_ROUTER),
+};
+
+static constexpr FieldEntry ACTIVITY_FIELDS[] = {
+        MANIFEST_FIELD("name", KEY_NAME),
+        MANIFEST_FIELD("launchMode", KEY_LAUNCH_MODE),
+        MANIFEST_FIELD("taskAffinity", KEY_TASK_AFFINITY),
+        MANIFEST_FIELD("intent-filter", KEY_INTENT_FILTER),
+};
+
+static constexpr FieldEntry SERVICE_FIELDS[] = {
+        MANIFEST_FIELD("name", KEY_NAME),
+        MANIFEST_FIELD("exported", KEY_EXPORTED),
+        MANIFEST_FIELD("priority", KEY_PRIORITY),
+        MANIFEST_FIELD("path", KEY_PATH),
+        MANIFEST_FIELD("type", KEY_TYPE),
+        MANIFEST_FIELD("intent-filter", KEY_INTENT_FILTER),
+};
+
+static constexpr FieldEntry INTENT_FILTER_FIELDS[] = {MANIFEST_FIELD("actions", KEY_ACTIONS)};
+static constexpr FieldEntry FEATURE_FIELDS[] = {MANIFEST_FIELD("name", KEY_NAME)};
+static constexpr FieldEntry ROUTER_FIELDS[] = {MANIFEST_FIELD("entry", KEY_ENTRY),
+                                               MANIFEST_FIELD("pages", KEY_PAGES)};
+
+/* root keys of the header tier, execfile is only looked for in a native manifest */
+static constexpr uint32_t HEADER_KEYS = 1u << KEY_PACKAGE | 1u << KEY_APP_TYPE |
+        1u << KEY_VERSION_NAME | 1u << KEY_SYSTEM_UI | 1u << KEY_NAME | 1u << KEY_ICON |
+        1u << KEY_PRIORITY | 1u << KEY_EXECFILE;
+
+template <size_t N>
+static ManifestKey findKey(const FieldEntry (&table)[N], const char *key, size_t length) {
+    for (const FieldEntry &entry : table) {
+        if (entry.length == length && memcmp(entry.key, key, length) == 0) {
+            return entry.id;
+        }
+    }
+    return KEY_NONE;
+}
+
+static ManifestKey findKey(Scope scope, const char *key, size_t length) {
+    switch (scope) {
+        case Scope::ROOT:
+            return findKey(ROOT_FIELDS, key, length);
+        case Scope::ACTIVITY:
+            return findKey(ACTIVITY_FIELDS, key, length);
+        case Scope::SERVICE:
+            return findKey(SERVICE_FIELDS, key, length);
+        case Scope::INTENT_FILTER:
+            return findKey(INTENT_FILTER_FIELDS, key, length);
+        case Scope::FEATURE:
+            return findKey(FEATURE_FIELDS, key, length);
+        case Scope::ROUTER:
+            return findKey(ROUTER_FIELDS, key, length);
+        default:
+            return KEY_NONE;
+    }
+}
+
+/* An activity or service as written, defaults depend on appType which may come later. */
+struct RawComponent {
+    std::optional<std::string> name;
+    std::optional<std::string> launchMode;
+    std::optional<std::string> taskAffinity;
+    std::optional<std::string> priority;
+    std::optional<std::string> path;
+    std::optional<std::string> type;
+    std::optional<bool> exported;
+    std::vector<std::string> actions;
+};
+
+class ManifestHandler
+      : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, ManifestHandler> {
+public:
+    explicit ManifestHandler(bool headerOnly)
+          : mHeaderOnly(headerOnly), mStopped(false), mActionTarget(nullptr) {
+        mStack.reserve(8);
+    }
+
+    bool Default() {
+        next();
+        return true;
+    }
+
+    bool Bool(bool value) {
+        ManifestKey key = next();
+        if (key == KEY_SYSTEM_UI) {
+            mSystemUI = value;
+        } else if (key == KEY_EXPORTED) {
+            mServices.back().exported = value;
+        }
+        return true;
+    }
+
+    bool Int(int value) {
+        if (next() == KEY_VERSION_CODE) {
+            mVersionCode = value;
+        }
+        return true;
+    }
+
+    bool Uint(unsigned value) {
+        if (next() == KEY_VERSION_CODE && value <= INT_MAX) {
+            mVersionCode = value;
+        }
+        return true;
+    }
+
+    bool String(const char *str, rapidjson::SizeType, bool) {
+        ManifestKey key = next();
+        if (key == KEY_ACTION) {
+            mActionTarget->emplace_back(str);
+        } else if (std::optional<std::string> *field = stringField(key)) {
+            field->emplace(str);
+        }
+        return true;
+    }
+
+    bool Key(const char *str, rapidjson::SizeType length, bool) {
+        Frame &frame = mStack.back();
+        frame.key = KEY_NONE;
+        if (frame.scope == Scope::PAGES) {
+            mPages.emplace_back(str);
+            return true;
+        }
+        ManifestKey key = findKey(frame.scope, str, length);
+        if (mHeaderOnly && frame.scope == Scope::ROOT) {
+            if (headerDone(frame.seen)) {
+                // the rest of the document can't change the header, stop reading it
+                mStopped = true;
+                return false;
+            }
+            if (!(HEADER_KEYS & (1u << key))) key = KEY_NONE;
+        }
+        if (key != KEY_NONE && !(frame.seen & (1u << key))) {
+            frame.seen |= 1u << key;
+            frame.key = key;
+        }
+        return true;
+    }
+
+    bool StartObject() {
+        if (mStack.empty()) {
+            push(Scope::ROOT);
+            return true;
+        }
+        ManifestKey key = next();
+        Scope scope = mStack.back().scope;
+        switch (key) {
+            case KEY_ELEMENT:
+                push(scope == Scope::ACTIVITIES ? Scope::ACTIVITY
+                                : scope == Scope::SERVICES ? Scope::SERVICE
+                                                           : Scope::FEATURE);
+                break;
+            case KEY_INTENT_FILTER:
+                mActionTarget = scope == Scope::ROOT ? &mActions
+                        : scope == Scope::ACTIVITY   ? &mActivities.back().actions
+                                                     : &mServices.back().actions;
+                push(Scope::INTENT_FILTER);
+                break;
+            case KEY_ROUTER:
+                push(Scope::ROUTER);
+                break;
+            case KEY_PAGES:
+                push(Scope::PAGES);
+                break;
+            default:
+                push(Scope::SKIP);
+                break;
+        }
+        return true;
+    }
+
+    bool StartArray() {
+        switch (next()) {
+            case KEY_ACTIVITIES:
+                push(Scope::ACTIVITIES);
+                break;
+            case KEY_SERVICES:
+                push(Scope::SERVICES);
+                break;
+            case KEY_FEATURES:
+                push(Scope::FEATURES);
+                break;
+            case KEY_ACTIONS:
+                push(Scope::ACTIONS);
+                break;
+            default:
+                push(Scope::SKIP);
+                break;
+        }
+        return true;
+    }
+
+    bool EndObject(rapidjson::SizeType) {
+        mStack.pop_back();
+        return true;
+    }
+
+    bool EndArray(rapidjson::SizeType) {
+        mStack.pop_back();
+        return true;
+    }
+
+    int finish(PackageInfo *info);
+    bool stopped() const {
+        return mStopped;
+    }
+
+private:
+    struct Frame {
+        Scope scope;
+        ManifestKey key; /* the field the next value belongs to */
+        uint32_t seen;   /* keys met in this object, duplicates after the first are ignored */
+    };
+
+    void push(Scope scope) {
+        mStack.push_back({scope, KEY_NONE, 0});
+    }
+
+    /*
+     * Whether every header key was seen, an absent one keeps the read going to the end of
+     * the root object, so a label is never taken from part of the header.
+     */
+    bool headerDone(uint32_t seen) const {
+        uint32_t wanted = HEADER_KEYS;
+        if (getApplicationType(mAppType.value_or("QUICKAPP")) != ApplicationType::NATIVE) {
+            wanted &= ~(1u << KEY_EXECFILE);
+        }
+        return (seen & wanted) == wanted;
+    }
+
+    /* Claim the next value of the innermost container, an array entry opens a new element. */
+    ManifestKey next() {
+        if (mStack.empty()) return KEY_NONE;
+        Frame &frame = mStack.back();
+        switch (frame.scope) {
+            case Scope::ACTIVITIES:
+                mActivities.emplace_back();
+                return KEY_ELEMENT;
+            case Scope::SERVICES:
+                mServices.emplace_back();
+                return KEY_ELEMENT;
+            case Scope::FEATURES:
+                mFeatures.emplace_back();
+                return KEY_ELEMENT;
+            case Scope::ACTIONS:
+                return KEY_ACTION;
+            default: {
+                ManifestKey key = frame.key;
+                frame.key = KEY_NONE;
+                return key;
+            }
+        }
+    }
+
+    std::optional<std::string> *stringField(ManifestKey key) {
+        switch (mStack.back().scope) {
+            case Scope::ROOT:
+                switch (key) {
+                    case KEY_PACKAGE:
+                        return &mPackage;
+                    case KEY_APP_TYPE:
+                        return &mAppType;
+                    case KEY_VERSION_NAME:
+                        return &mVersionName;
+                    case KEY_NAME:
+                        return &mName;
+                    case KEY_ICON:
+                        return &mIcon;
+                    case KEY_PRIORITY:
+                        return &mPriority;
+                    case KEY_ENTRY:
+                        return &mEntry;
+                    case KEY_EXECFILE:
+                        return &mExecfile;
+                    default:
+                        return nullptr;
+                }
+            case Scope::ACTIVITY:
+            case Scope::SERVICE: {
+                RawComponent &component = mStack.back().scope == Scope::ACTIVITY
+                        ? mActivities.back()
+                        : mServices.back();
+                switch (key) {
+                    case KEY_NAME:
+                        return &component.name;
+                    case KEY_LAUNCH_MODE:
+                        return &component.launchMode;
+                    case KEY_TASK_AFFINITY:
+                        return &component.taskAffinity;
+                    case KEY_PRIORITY:
+                        return &component.priority;
+                    case KEY_PATH:
+                        return &component.path;
+                    case KEY_TYPE:
+                        return &component.type;
+                    default:
+                        return nullptr;
+                }
+            }
+            case Scope::FEATURE:
+                return key == KEY_NAME ? &mFeatures.back() : nullptr;
+            case Scope::ROUTER:
+                return key == KEY_ENTRY ? &mRouterEntry : nullptr;
+            default:
+                return nullptr;
+        }
+    }
+
+    int finishNative(PackageInfo *info);
+    int finishQuickApp(PackageInfo *info);
+
+    bool mHeaderOnly;
+    bool mStopped;
+    std::vector<Frame> mStack;
+    std::vector<std::string> *mActionTarget;
+    std::optional<std::string> mPackage;
+    std::optional<std::string> mAppType;
+    std::optional<std::string> mVersionName;
+    std::optional<std::string> mName;
+    std::optional<std::string> mIcon;
+    std::optional<std::string> mPriority;
+    std::optional<std::string> mEntry;
+    std::optional<std::string> mExecfile;
+    std::optional<std::string> mRouterEntry;
+    std::optional<bool> mSystemUI;
+    std::optional<int> mVersionCode;
+    std::vector<RawComponent> mActivities;
+    std::vector<RawComponent> mServices;
+    std::vector<std::string> mActions; /* the quickapp intent-filter */
+    std::vector<std::optional<std::string>> mFeatures;
+    std::vector<std::string> mPages;
+}; // class ManifestHandler
+
+int ManifestHandler::finish(PackageInfo *info) {
+    if (info->packageName.empty()) {
+        info->packageName = mPackage.value_or("");
+        if (info->packageName.empty()) {
+            ALOGE("Failed parse manifest:%s package field", info->manifest.c_str());
+            return android::BAD_VALUE;
+        }
+        info->appType = mAppType.value_or("QUICKAPP");
+        info->version = mVersionName.value_or("");
+    }
+    info->name = mName.value_or("");
+    info->icon = mIcon.value_or("");
+    info->isSystemUI = mSystemUI.value_or(false);
+    info->priority = getProcessPriority(mPriority.value_or("middle"));
+    ApplicationType type = getApplicationType(info->appType);
+    if (mHeaderOnly) {
+        // components, the entry check and the quickapp defaults are left to the full parse
+        if (type == ApplicationType::NATIVE && mExecfile.value_or("").empty()) {
+            ALOGE("Failed parse manifest:%s execfile field", info->manifest.c_str());
+            return android::BAD_VALUE;
+        }
+        return type == ApplicationType::UNKNOWN ? android::BAD_TYPE : 0;
+    }
+
+    switch (type) {
+        case ApplicationType::NATIVE:
+            return finishNative(info);
+        case ApplicationType::QUICKAPP:
+            return finishQuickApp(info);
+        default:
+            return android::BAD_TYPE;
+    }
+}
+
+int ManifestHandler::finishNative(PackageInfo *info) {
+    info->entry = mEntry.value_or("");
+    info->execfile = mExecfile.value_or("");
+    if (info->execfile.empty()) {
+        ALOGE("Failed parse manifest:%s execfile field", info->manifest.c_str());
+        return android::BAD_VALUE;
+    }
+    for (RawComponent &raw : mActivities) {
+        ActivityInfo activityInfo;
+        activityInfo.name = raw.name.value_or("");
+        if (activityInfo.name.empty()) {
+            ALOGE("Failed parse manifest:%s activities.name field", info->manifest.c_str());
+            return android::BAD_VALUE;
+        }
+        activityInfo.launchMode = raw.launchMode.value_or("standard");
+        activityInfo.taskAffinity = raw.taskAffinity.value_or(info->packageName);
+        activityInfo.actions = std::move(raw.actions);
+        info->activitiesInfo.push_back(std::move(activityInfo));
+    }
+
+    for (RawComponent &raw : mServices) {
+        ServiceInfo serviceInfo;
+        serviceInfo.name = raw.name.value_or("");
+        if (serviceInfo.name.empty()) {
+            ALOGE("Failed parse manifest:%s services.name field", info->manifest.c_str());
+            return android::BAD_VALUE;
+        }
+        serviceInfo.exported = raw.exported.value_or(false);
+        serviceInfo.priority = getProcessPriority(raw.priority.value_or("persistent"));
+        serviceInfo.actions = std::move(raw.actions);
+        info->servicesInfo.push_back(std::move(serviceInfo));
+    }
+
+    // check entry valid
+    bool bEntryValid = info->entry.empty();
+    for (const auto &activity : info->activitiesInfo) {
+        if (activity.name == info->entry) {
+            bEntryValid = true;
+            break;
+        }
+    }
+    if (!bEntryValid) {
+        ALOGE("Failed parse manifest:%s entry field", info->entry.c_str());
+        return android::BAD_VALUE;
+    }
+    return 0;
+}
+
+int ManifestHandler::finishQuickApp(PackageInfo *info) {
+    info->execfile = mExecfile.value_or("vappxms");
+    info->entry = mEntry.value_or("QuickActivity");
+    ActivityInfo defaultActivity;
+    defaultActivity.name = "QuickActivity";
+    defaultActivity.launchMode = "singleTask";
+    defaultActivity.taskAffinity = info->packageName;
+    defaultActivity.actions = std::move(mActions);
+    info->activitiesInfo.push_back(std::move(defaultActivity));
+
+    QuickAppInfo quickappInfo;
+    quickappInfo.versionCode = mVersionCode.value_or(0);
+    for (auto &feature : mFeatures) {
+        if (feature && !feature->empty()) {
+            quickappInfo.features.push_back(std::move(*feature));
+        }
+    }
+    quickappInfo.router.entry = mRouterEntry.value_or("");
+    for (auto &pageName : mPages) {
+        PageInfo page;
+        page.pageName = std::move(pageName);
+        quickappInfo.router.pages.push_back(std::move(page));
+    }
+
+    for (const RawComponent &raw : mServices) {
+        ServiceInfo serviceInfo;
+        serviceInfo.name = raw.name.value_or("");
+        serviceInfo.path = raw.path.value_or("");
+        serviceInfo.type = raw.type.value_or("js");
+        serviceInfo.priority = getProcessPriority(raw.priority.value_or("persistent"));
+        info->servicesInfo.push_back(std::move(serviceInfo));
+    }
+    info->extra = std::move(quickappInfo);
+    return 0;
+}
+
+template <unsigned parseFlags, typename Stream>
+static int parseStream(Stream &stream, PackageInfo *info, int32_t fields) {
+    ManifestHandler handler(!(fields & PACKAGE_FIELD_MANIFEST & ~PACKAGE_FIELD_LABEL));
+    rapidjson::Reader reader;
+    if (reader.Parse<parseFlags>(stream, handler).IsError() && !handler.stopped()) {
+        ALOGE("parse file %s failed,is not json format", info->manifest.c_str());
+        return android::BAD_VALUE;
+    }
+    return handler.finish(info);
+}
+
+int PackageManifestReader::parse(const char *json, PackageInfo *info, int32_t fields) {
+    if (info == nullptr) {
+        return android::NO_INIT;
+    }
+    rapidjson::StringStream stream(json);
+    return parseStream<rapidjson::kParseDefaultFlags>(stream, info, fields);
+}
+
+int PackageManifestReader::parseFile(const char *path, PackageInfo *info, int32_t fields) {
+    if (info == nullptr) {
+        return android::NO_INIT;
+    }
+    FileBuffer buffer;
+    int ret = buffer.load(path);
+    if (ret < 0) {
+        ALOGE("read file %s failed", path);
+        return ret;
+    }
+    // strings are decoded in place, the handler copies the ones it keeps
+    rapidjson::InsituStringStream stream(buffer.data());
+    return parseStream<rapidjson::kParseInsituFlag>(stream, info, fields);
+}
+
+} // namespace pm
+} // namespace os
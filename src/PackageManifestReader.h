@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "pm/PackageInfo.h"
+
+namespace os {
+namespace pm {
+
+/*
+ * Streaming manifest reader.
+ *
+ * Walks manifest.json with the rapidjson SAX reader and keeps only the keys in its
+ * field tables, no DOM is built. The result, defaults and errors included, is the one
+ * PackageParser::parseDocument gives for the same text: the first of duplicated keys
+ * wins and a value of the wrong type reads as absent.
+ *
+ * When fields asks for nothing beyond PACKAGE_FIELD_LABEL only the header is read:
+ * package, appType, versionName, isSystemUI, name, icon, priority and, for a native app,
+ * execfile. Reading stops once all of them are seen, wherever they sit in the root object,
+ * and goes to its end when one is absent. Components and the checks on them wait for a
+ * full parse.
+ */
+class PackageManifestReader {
+public:
+    /* Fill info from NUL terminated manifest text, info->manifest names it in the log. */
+    static int parse(const char *json, PackageInfo *info,
+                     int32_t fields = PACKAGE_FIELD_MANIFEST);
+    /* Load path into a FileBuffer and parse it in place. */
+    static int parseFile(const char *path, PackageInfo *info,
+                         int32_t fields = PACKAGE_FIELD_MANIFEST);
+};
+
+} // namespace pm
+} // namespace os
@@ -16,6 +16,7 @@
 
 #include "PackageParser.h"
 
+#include "PackageManifestReader.h"
 #include "PackageUtils.h"
 #include "os/pm/PageInfo.h"
 #include "os/pm/QuickAppInfo.h"
@@ -23,15 +24,127 @@
 
 namespace os {
 namespace pm {
-int PackageParser::parseManifest(PackageInfo *info) {
+PackageParser::PackageParser(PackageFlusher *flusher)
+      : mCache(PackageConfig::getInstance().getManifestCachePath()), mFlusher(flusher) {
+    mCacheTask = mFlusher->addTask([this]() { return mCache.flush(); });
+}
+
+int PackageParser::parseManifest(PackageInfo *info, int32_t fields) {
     if (info == nullptr) {
         return android::NO_INIT;
     }
 
-    rapidjson::Document document;
-    int ret = getDocument(info->manifest.c_str(), document);
+    bool headerOnly = !(fields & PACKAGE_FIELD_MANIFEST & ~PACKAGE_FIELD_LABEL);
+    FileStamp stamp;
+    int ret = getFileStamp(info->manifest.c_str(), &stamp);
+    if (ret) {
+        ALOGE("read file %s failed", info->manifest.c_str());
+        return ret;
+    }
+    // a broken manifest costs the hash until it changes, not a parse per request
+    ret = lookupFailure(info->manifest, stamp, headerOnly);
     if (ret) return ret;
 
+    bool isNewPackage = info->packageName.empty();
+    int32_t parsed = PACKAGE_FIELD_MANIFEST;
+    if (!mCache.get(info->manifest, stamp, info)) {
+        if (headerOnly) {
+            // the header tier, only complete manifests go into the cache
+            parsed = PACKAGE_FIELD_LABEL;
+        }
+        ret = PackageManifestReader::parseFile(info->manifest.c_str(), info, parsed);
+        if (ret) {
+            recordFailure(*info, stamp, headerOnly, ret);
+            return ret;
+        }
+        if (parsed == PACKAGE_FIELD_MANIFEST) {
+            mCache.put(info->manifest, stamp, *info);
+        }
+    }
+    if (parsed == PACKAGE_FIELD_MANIFEST) {
+        clearFailure(info->manifest);
+    }
+
+    if (isNewPackage) {
+        std::string sPath = info->manifest;
+        info->installedPath = sPath.replace(sPath.end() - strlen(MANIFEST), sPath.end(), "");
+        info->installTime = getCurrentTime();
+        // measured together by the install pipeline or in the background by PackageSizeCache
+        info->size = PACKAGE_SIZE_UNKNOWN;
+        info->shasum.clear();
+    }
+    info->parsedFields |= parsed;
+    return 0;
+}
+
+void PackageParser::invalidateCache(const std::string &manifest) {
+    mCache.erase(manifest);
+    clearFailure(manifest);
+}
+
+void PackageParser::moveCache(const std::string &from, const std::string &to) {
+    mCache.move(from, to);
+}
+
+void PackageParser::scheduleCacheFlush() {
+    mFlusher->schedule(mCacheTask);
+}
+
+int PackageParser::lookupFailure(const std::string &manifest, const FileStamp &stamp,
+                                 bool headerOnly) {
+    std::lock_guard<std::mutex> lock(mFailureLock);
+    auto it = mFailures.find(manifest);
+    if (it == mFailures.end()) {
+        return 0;
+    }
+    Failure &failure = it->second;
+    if (failure.stamp != stamp) {
+        // edited since, parse it again
+        mFailures.erase(it);
+        return 0;
+    }
+    if (headerOnly && !failure.headerOnly) {
+        // only the components are broken, the header still reads
+        return 0;
+    }
+    failure.skipped++;
+    return failure.error;
+}
+
+void PackageParser::recordFailure(const PackageInfo &info, const FileStamp &stamp,
+                                  bool headerOnly, int error) {
+    ALOGW("manifest %s failed:%d, skipped until it changes", info.manifest.c_str(), error);
+    std::lock_guard<std::mutex> lock(mFailureLock);
+    mFailures[info.manifest] = {info.packageName, stamp, headerOnly, error, getCurrentTime(), 0};
+}
+
+void PackageParser::clearFailure(const std::string &manifest) {
+    std::lock_guard<std::mutex> lock(mFailureLock);
+    mFailures.erase(manifest);
+}
+
+std::vector<ParseFailure> PackageParser::getFailures() {
+    std::lock_guard<std::mutex> lock(mFailureLock);
+    std::vector<ParseFailure> failures;
+    failures.reserve(mFailures.size());
+    for (const auto &[manifest, failure] : mFailures) {
+        ParseFailure item;
+        item.packageName = failure.packageName;
+        item.manifest = manifest;
+        item.error = failure.error;
+        item.failTime = failure.time;
+        item.skipped = failure.skipped;
+        failures.push_back(std::move(item));
+    }
+    return failures;
+}
+
+bool PackageParser::hasFailure(const std::string &manifest) {
+    std::lock_guard<std::mutex> lock(mFailureLock);
+    return mFailures.count(manifest) != 0;
+}
+
+int PackageParser::parseDocument(const rapidjson::Document &document, PackageInfo *info) {
     if (info->packageName.empty()) {
         info->packageName = getValue<std::string>(document, "package", "");
         if (info->packageName.empty()) {
@@ -40,11 +153,6 @@ int PackageParser::parseManifest(PackageInfo *info) {
         }
         info->appType = getValue<std::string>(document, "appType", "QUICKAPP");
         info->version = getValue<std::string>(document, "versionName", "");
-        std::string sPath = info->manifest;
-        info->installedPath = sPath.replace(sPath.end() - strlen(MANIFEST), sPath.end(), "");
-        info->installTime = getCurrentTime();
-        info->size = getDirectorySize(info->installedPath.c_str());
-        info->shasum = calculateShasum(info->installedPath.c_str());
     }
     info->name = getValue<std::string>(document, "name", "");
     info->icon = getValue<std::string>(document, "icon", "");
@@ -53,19 +161,12 @@ int PackageParser::parseManifest(PackageInfo *info) {
 
     switch (getApplicationType(info->appType)) {
         case ApplicationType::NATIVE:
-            ret = parseNativeManifest(document, info);
-            break;
+            return parseNativeManifest(document, info);
         case ApplicationType::QUICKAPP:
-            ret = parseQuickAppManifest(document, info);
-            break;
+            return parseQuickAppManifest(document, info);
         default:
-            ret = android::BAD_TYPE;
-    }
-
-    if (!ret) {
-        info->bAllValid = true;
+            return android::BAD_TYPE;
     }
-    return ret;
 }
 
 int PackageParser::parseNativeManifest(const rapidjson::Document &document, PackageInfo *info) {
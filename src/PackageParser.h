@@ -16,9 +16,14 @@
 
 #pragma once
 
+#include <map>
+#include <mutex>
 #include <optional>
 
+#include "PackageFlusher.h"
+#include "PackageManifestCache.h"
 #include "PackageUtils.h"
+#include "os/pm/ParseFailure.h"
 #include "pm/PackageInfo.h"
 
 namespace os {
@@ -26,11 +31,44 @@ namespace pm {
 
 class PackageParser {
 public:
-    int parseManifest(PackageInfo *info);
+    explicit PackageParser(PackageFlusher *flusher);
+    /*
+     * Parse at least the groups in fields and add them to info->parsedFields. Asking for
+     * PACKAGE_FIELD_LABEL alone reads only the manifest header, see PackageManifestReader.
+     */
+    int parseManifest(PackageInfo *info, int32_t fields = PACKAGE_FIELD_MANIFEST);
+    /* Forget both the parsed manifest and a failure to parse it. */
+    void invalidateCache(const std::string &manifest);
+    void moveCache(const std::string &from, const std::string &to);
+    /* Write the cache back within the flush delay, the caller must not hold any lock. */
+    void scheduleCacheFlush();
+    /* DOM reference for PackageManifestReader, the conformance test and benchmark use it. */
+    static int parseDocument(const rapidjson::Document &document, PackageInfo *info);
+    std::vector<ParseFailure> getFailures();
+    /* Whether a failure is recorded for manifest, from memory only, the file is not checked. */
+    bool hasFailure(const std::string &manifest);
 
 private:
-    int parseNativeManifest(const rapidjson::Document &document, PackageInfo *info);
-    int parseQuickAppManifest(const rapidjson::Document &document, PackageInfo *info);
+    /* A manifest that failed to parse, requests up to its tier fail until the file changes. */
+    struct Failure {
+        std::string packageName;
+        FileStamp stamp; /* content hash included, an edit keeping the stat is seen */
+        bool headerOnly; /* only the full parse failed when false */
+        int error;
+        std::string time;
+        int32_t skipped;
+    };
+    int lookupFailure(const std::string &manifest, const FileStamp &stamp, bool headerOnly);
+    void recordFailure(const PackageInfo &info, const FileStamp &stamp, bool headerOnly,
+                       int error);
+    void clearFailure(const std::string &manifest);
+    static int parseNativeManifest(const rapidjson::Document &document, PackageInfo *info);
+    static int parseQuickAppManifest(const rapidjson::Document &document, PackageInfo *info);
+    PackageManifestCache mCache;
+    PackageFlusher *mFlusher;
+    size_t mCacheTask;
+    std::mutex mFailureLock;
+    std::map<std::string, Failure> mFailures; /* by manifest path */
 }; // class PackageParser
 
 } // namespace pm
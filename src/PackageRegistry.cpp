@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageRegistry.h"
+
+#include <algorithm>
+
+namespace os {
+namespace pm {
+
+static uint32_t hashName(std::string_view packageName) {
+    // FNV-1a, names are short and this keeps the index identical across runs
+    uint32_t hash = 2166136261u;
+    for (char c : packageName) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+PackageHandle PackageRegistry::Snapshot::lookup(std::string_view packageName) const {
+    if (mIndex.empty()) {
+        return PACKAGE_HANDLE_INVALID;
+    }
+    uint32_t hash = hashName(packageName);
+    size_t mask = mIndex.size() - 1;
+    for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+        const Slot &slot = mIndex[pos];
+        if (slot.handle == PACKAGE_HANDLE_INVALID) {
+            return PACKAGE_HANDLE_INVALID;
+        }
+        if (slot.hash == hash && mRecords[slot.handle].name == packageName) {
+            return slot.handle;
+        }
+    }
+}
+
+PackageRegistry::Entry PackageRegistry::Snapshot::get(PackageHandle handle) const {
+    return handle < mRecords.size() ? mRecords[handle].entry : nullptr;
+}
+
+const std::vector<ComponentRef> *PackageRegistry::Snapshot::resolve(
+        const std::string &action) const {
+    auto it = mActions->find(action);
+    return it != mActions->end() ? &it->second : nullptr;
+}
+
+void PackageRegistry::Snapshot::insertSlot(uint32_t hash, PackageHandle handle) {
+    size_t mask = mIndex.size() - 1;
+    size_t pos = hash & mask;
+    while (mIndex[pos].handle != PACKAGE_HANDLE_INVALID) {
+        pos = (pos + 1) & mask;
+    }
+    mIndex[pos] = {hash, handle};
+}
+
+void PackageRegistry::Snapshot::rehash(size_t capacity) {
+    std::vector<Slot> index(capacity, Slot{0, PACKAGE_HANDLE_INVALID});
+    mIndex.swap(index);
+    for (const Slot &slot : index) {
+        if (slot.handle != PACKAGE_HANDLE_INVALID) {
+            insertSlot(slot.hash, slot.handle);
+        }
+    }
+}
+
+PackageHandle PackageRegistry::Writer::put(const Entry &entry) {
+    Snapshot &snapshot = *mSnapshot;
+    PackageHandle handle = snapshot.lookup(entry->packageName);
+    if (handle == PACKAGE_HANDLE_INVALID) {
+        handle = snapshot.mRecords.size();
+        snapshot.mRecords.push_back({mRegistry->intern(entry->packageName), nullptr});
+        if (snapshot.mRecords.size() * 2 > snapshot.mIndex.size()) {
+            snapshot.rehash(std::max<size_t>(16, snapshot.mIndex.size() * 2));
+        }
+        snapshot.insertSlot(hashName(entry->packageName), handle);
+        // names are only added on a first install, enumeration keeps the old map order
+        auto pos = std::lower_bound(snapshot.mOrder.begin(), snapshot.mOrder.end(),
+                                    snapshot.mRecords[handle].name,
+                                    [&](PackageHandle other, std::string_view name) {
+                                        return snapshot.mRecords[other].name < name;
+                                    });
+        snapshot.mOrder.insert(pos, handle);
+    }
+    replaceEntry(handle, entry);
+    return handle;
+}
+
+bool PackageRegistry::Writer::erase(std::string_view packageName) {
+    PackageHandle handle = mSnapshot->lookup(packageName);
+    if (handle == PACKAGE_HANDLE_INVALID || !mSnapshot->mRecords[handle].entry) {
+        return false;
+    }
+    // the name stays indexed, a reinstall takes the handle back
+    replaceEntry(handle, nullptr);
+    return true;
+}
+
+static bool sameActions(const PackageInfo *a, const PackageInfo *b) {
+    if (a == b) return true;
+    if (!a || !b || a->activitiesInfo.size() != b->activitiesInfo.size() ||
+        a->servicesInfo.size() != b->servicesInfo.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a->activitiesInfo.size(); i++) {
+        if (a->activitiesInfo[i].actions != b->activitiesInfo[i].actions) return false;
+    }
+    for (size_t i = 0; i < a->servicesInfo.size(); i++) {
+        if (a->servicesInfo[i].actions != b->servicesInfo[i].actions) return false;
+    }
+    return true;
+}
+
+void PackageRegistry::Writer::replaceEntry(PackageHandle handle, const Entry &entry) {
+    Entry &current = mSnapshot->mRecords[handle].entry;
+    // size and shasum updates keep the components, the index is left alone for them
+    if (!sameActions(current.get(), entry.get())) {
+        if (current) unindex(handle, current);
+        if (entry) index(handle, entry);
+    }
+    if (current) {
+        mSnapshot->mCount--;
+        if (!current->isParsed(PACKAGE_FIELD_MANIFEST)) mSnapshot->mUnparsed--;
+    }
+    if (entry) {
+        mSnapshot->mCount++;
+        if (!entry->isParsed(PACKAGE_FIELD_MANIFEST)) mSnapshot->mUnparsed++;
+    }
+    current = entry;
+}
+
+PackageRegistry::ActionIndex &PackageRegistry::Writer::actions() {
+    if (!mActions) {
+        auto copy = std::make_shared<ActionIndex>(*mSnapshot->mActions);
+        mActions = copy.get();
+        mSnapshot->mActions = std::move(copy);
+    }
+    return *mActions;
+}
+
+void PackageRegistry::Writer::index(PackageHandle handle, const Entry &entry) {
+    if (!entry->isParsed(PACKAGE_FIELD_ACTIVITIES | PACKAGE_FIELD_SERVICES)) {
+        return;
+    }
+    for (size_t i = 0; i < entry->activitiesInfo.size(); i++) {
+        for (const auto &action : entry->activitiesInfo[i].actions) {
+            actions()[action].push_back({handle, COMPONENT_ACTIVITY, static_cast<uint16_t>(i)});
+        }
+    }
+    for (size_t i = 0; i < entry->servicesInfo.size(); i++) {
+        for (const auto &action : entry->servicesInfo[i].actions) {
+            actions()[action].push_back({handle, COMPONENT_SERVICE, static_cast<uint16_t>(i)});
+        }
+    }
+}
+
+void PackageRegistry::Writer::unindex(PackageHandle handle, const Entry &entry) {
+    auto drop = [&](const std::vector<std::string> &names) {
+        for (const auto &action : names) {
+            auto it = actions().find(action);
+            if (it == actions().end()) continue;
+            auto &refs = it->second;
+            refs.erase(std::remove_if(refs.begin(), refs.end(),
+                                      [&](const ComponentRef &ref) {
+                                          return ref.handle == handle;
+                                      }),
+                       refs.end());
+            if (refs.empty()) actions().erase(it);
+        }
+    };
+    for (const auto &activity : entry->activitiesInfo) {
+        drop(activity.actions);
+    }
+    for (const auto &service : entry->servicesInfo) {
+        drop(service.actions);
+    }
+}
+
+PackageRegistry::Reader::Reader(const PackageRegistry *registry, uint32_t slot,
+                                const Snapshot *snapshot)
+      : mRegistry(registry), mSlot(slot), mSnapshot(snapshot) {}
+
+PackageRegistry::Reader::Reader(Reader &&other)
+      : mRegistry(other.mRegistry), mSlot(other.mSlot), mSnapshot(other.mSnapshot) {
+    other.mRegistry = nullptr;
+}
+
+PackageRegistry::Reader::~Reader() {
+    if (mRegistry) {
+        mRegistry->leave(mSlot);
+    }
+}
+
+PackageRegistry::PackageRegistry() : mCurrent(new Snapshot()), mEpoch(0), mDraining(false) {
+    mReaders[0] = 0;
+    mReaders[1] = 0;
+}
+
+PackageRegistry::~PackageRegistry() {
+    delete mCurrent.load();
+}
+
+PackageRegistry::Reader PackageRegistry::read() const {
+    uint32_t epoch;
+    while (true) {
+        epoch = mEpoch.load();
+        mReaders[epoch & 1].fetch_add(1);
+        // a writer flipped the epoch in between, it may not wait for this slot
+        if (mEpoch.load() == epoch) break;
+        leave(epoch & 1);
+    }
+    return Reader(this, epoch & 1, mCurrent.load());
+}
+
+PackageRegistry::Entry PackageRegistry::find(std::string_view packageName,
+                                             PackageHandle *handle) const {
+    auto snapshot = read();
+    PackageHandle found = snapshot->lookup(packageName);
+    if (handle) *handle = found;
+    return snapshot->get(found);
+}
+
+void PackageRegistry::update(const std::function<void(Writer &)> &mutate) {
+    std::lock_guard<std::mutex> lock(mWriteLock);
+    updateLocked(mutate);
+}
+
+bool PackageRegistry::tryUpdate(const std::function<void(Writer &)> &mutate) {
+    std::unique_lock<std::mutex> lock(mWriteLock, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return false;
+    }
+    updateLocked(mutate);
+    return true;
+}
+
+static void applyReplacements(PackageRegistry::Writer &writer,
+                              const std::vector<PackageRegistry::Replacement> &replacements) {
+    for (const auto &replacement : replacements) {
+        if (writer.snapshot().get(replacement.handle) == replacement.expected) {
+            writer.put(replacement.desired);
+        }
+    }
+}
+
+void PackageRegistry::replace(const std::vector<Replacement> &replacements) {
+    update([&](Writer &writer) { applyReplacements(writer, replacements); });
+}
+
+bool PackageRegistry::tryReplace(const std::vector<Replacement> &replacements) {
+    return tryUpdate([&](Writer &writer) { applyReplacements(writer, replacements); });
+}
+
+std::string_view PackageRegistry::intern(std::string_view packageName) {
+    return mNames.emplace_back(packageName);
+}
+
+void PackageRegistry::updateLocked(const std::function<void(Writer &)> &mutate) {
+    const Snapshot *old = mCurrent.load();
+    Snapshot *next = new Snapshot(*old);
+    next->mVersion++;
+    Writer writer(this, next);
+    mutate(writer);
+    mCurrent.store(next);
+
+    // readers arriving from now on see the new epoch and the new snapshot,
+    // the old one goes once the readers of the previous epoch have left.
+    // Sleep rather than spin, a spinning writer would starve a lower priority reader.
+    uint32_t epoch = mEpoch.fetch_add(1);
+    {
+        std::unique_lock<std::mutex> lock(mDrainLock);
+        mDraining.store(true);
+        mDrained.wait(lock, [&]() { return mReaders[epoch & 1].load() == 0; });
+        mDraining.store(false);
+    }
+    delete old;
+}
+
+void PackageRegistry::leave(uint32_t slot) const {
+    // the writer raises mDraining before it checks the count, so either it sees this
+    // reader gone or this reader sees it waiting
+    if (mReaders[slot].fetch_sub(1) == 1 && mDraining.load()) {
+        std::lock_guard<std::mutex> lock(mDrainLock);
+        mDrained.notify_all();
+    }
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "pm/PackageInfo.h"
+
+namespace os {
+namespace pm {
+
+/* Interned id of a package name, it's never reused while the service runs. */
+using PackageHandle = uint32_t;
+#define PACKAGE_HANDLE_INVALID UINT32_MAX
+
+enum ComponentKind { COMPONENT_ACTIVITY = 0, COMPONENT_SERVICE = 1 };
+
+/* An activity or service of a package, index is its position in the package lists. */
+struct ComponentRef {
+    PackageHandle handle;
+    uint16_t kind;
+    uint16_t index;
+};
+
+/*
+ * Installed packages as seen by the binder methods, published RCU style.
+ *
+ * A snapshot is never modified once published. Writers copy the current one,
+ * edit the copy and swap it in; the old one is freed after every reader that
+ * could still see it has left. Readers only bump a counter, they never block
+ * on a writer, the last one out of an epoch wakes the writer waiting for it. Entries are shared between snapshots, so a copy costs one
+ * pointer per package.
+ */
+class PackageRegistry {
+public:
+    using Entry = std::shared_ptr<const PackageInfo>;
+    using ActionIndex = std::unordered_map<std::string, std::vector<ComponentRef>>;
+
+    /*
+     * Packages sit in a dense array indexed by handle and are found through an
+     * open addressing index of (hash, handle) pairs, a lookup touches one or two
+     * index slots and a single record. An uninstalled package keeps its handle
+     * with an empty entry, so a reinstall gets the same one back.
+     */
+    class Snapshot {
+    public:
+        uint64_t version() const {
+            return mVersion;
+        }
+        size_t size() const {
+            return mCount;
+        }
+        /* Entries loaded from the registry whose manifest isn't parsed, nor indexed, yet. */
+        size_t unparsed() const {
+            return mUnparsed;
+        }
+        PackageHandle lookup(std::string_view packageName) const;
+        Entry get(PackageHandle handle) const;
+        Entry find(std::string_view packageName) const {
+            return get(lookup(packageName));
+        }
+        /* Components declaring the action in their intent-filter, nullptr if none. */
+        const std::vector<ComponentRef> *resolve(const std::string &action) const;
+        /* Visits the installed packages in package name order. */
+        template <typename Visitor>
+        void forEach(Visitor visit) const {
+            for (PackageHandle handle : mOrder) {
+                if (mRecords[handle].entry) {
+                    visit(handle, mRecords[handle].entry);
+                }
+            }
+        }
+
+    private:
+        friend class PackageRegistry;
+        friend class Writer;
+        Snapshot() : mVersion(0), mCount(0), mUnparsed(0), mActions(new ActionIndex()) {}
+        struct Record {
+            std::string_view name; /* points into the registry name pool */
+            Entry entry;
+        };
+        struct Slot {
+            uint32_t hash;
+            PackageHandle handle;
+        };
+        void insertSlot(uint32_t hash, PackageHandle handle);
+        void rehash(size_t capacity);
+
+        uint64_t mVersion;
+        size_t mCount;
+        size_t mUnparsed;
+        std::vector<Record> mRecords;
+        std::vector<Slot> mIndex;          /* power of two, at most half full */
+        std::vector<PackageHandle> mOrder; /* handles sorted by name, only grows with them */
+        std::shared_ptr<const ActionIndex> mActions; /* shared until a writer changes it */
+    };
+
+    /* Edits the copy a writer is about to publish. */
+    class Writer {
+    public:
+        const Snapshot &snapshot() const {
+            return *mSnapshot;
+        }
+        Entry find(std::string_view packageName) const {
+            return mSnapshot->find(packageName);
+        }
+        /* Adds the entry or replaces the one with the same package name. */
+        PackageHandle put(const Entry &entry);
+        bool erase(std::string_view packageName);
+
+    private:
+        friend class PackageRegistry;
+        Writer(PackageRegistry *registry, Snapshot *snapshot)
+              : mRegistry(registry), mSnapshot(snapshot), mActions(nullptr) {}
+        ActionIndex &actions();
+        void index(PackageHandle handle, const Entry &entry);
+        void unindex(PackageHandle handle, const Entry &entry);
+        void replaceEntry(PackageHandle handle, const Entry &entry);
+
+        PackageRegistry *mRegistry;
+        Snapshot *mSnapshot;
+        ActionIndex *mActions; /* the snapshot's own copy once made */
+    };
+
+    /* Read side critical section, the snapshot stays valid until it is destroyed. */
+    class Reader {
+    public:
+        Reader(Reader &&other);
+        ~Reader();
+        const Snapshot *operator->() const {
+            return mSnapshot;
+        }
+        const Snapshot &operator*() const {
+            return *mSnapshot;
+        }
+
+    private:
+        friend class PackageRegistry;
+        Reader(const PackageRegistry *registry, uint32_t slot, const Snapshot *snapshot);
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        const PackageRegistry *mRegistry;
+        uint32_t mSlot;
+        const Snapshot *mSnapshot;
+    };
+
+    struct Replacement {
+        PackageHandle handle;
+        Entry expected;
+        Entry desired;
+    };
+
+    PackageRegistry();
+    ~PackageRegistry();
+    /* Never call update() while holding a Reader, it waits for the reader to leave. */
+    Reader read() const;
+    Entry find(std::string_view packageName, PackageHandle *handle = nullptr) const;
+    void update(const std::function<void(Writer &)> &mutate);
+    /* Like update(), but gives up instead of waiting for another writer. */
+    bool tryUpdate(const std::function<void(Writer &)> &mutate);
+    /* Swaps in the entries still holding their expected value. */
+    void replace(const std::vector<Replacement> &replacements);
+    bool tryReplace(const std::vector<Replacement> &replacements);
+
+private:
+    void updateLocked(const std::function<void(Writer &)> &mutate);
+    void leave(uint32_t slot) const;
+    std::string_view intern(std::string_view packageName);
+
+    std::atomic<const Snapshot *> mCurrent;
+    mutable std::atomic<uint32_t> mEpoch;
+    mutable std::atomic<uint32_t> mReaders[2]; /* readers per epoch parity */
+    mutable std::atomic<bool> mDraining;        /* a writer waits for an epoch to drain */
+    mutable std::mutex mDrainLock;
+    mutable std::condition_variable mDrained;
+    std::mutex mWriteLock;
+    std::deque<std::string> mNames; /* guarded by mWriteLock, elements never move */
+}; // class PackageRegistry
+
+} // namespace pm
+} // namespace os
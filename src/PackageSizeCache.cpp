@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageSizeCache.h"
+
+#include <utils/Log.h>
+
+#include "PackageDigest.h"
+
+namespace os {
+namespace pm {
+
+static void measure(const std::string &path, int64_t *size, std::string *shasum) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    if (sha256Path(path.c_str(), digest, size)) {
+        *size = getDirectorySize(path.c_str());
+        shasum->clear();
+        return;
+    }
+    *shasum = Sha256::toHex(digest);
+}
+
+PackageSizeCache::PackageSizeCache(Callback onMeasured)
+      : mOnMeasured(std::move(onMeasured)), mGeneration(0), mExit(false), mStarted(false) {}
+
+PackageSizeCache::~PackageSizeCache() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mExit = true;
+    }
+    mCond.notify_all();
+    if (mStarted) {
+        pthread_join(mThread, nullptr);
+    }
+}
+
+void PackageSizeCache::set(const std::string &packageName, int64_t size,
+                           const std::string &shasum) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mEntries[packageName] = {size, shasum, ++mGeneration};
+}
+
+void PackageSizeCache::request(const std::string &packageName, const std::string &path) {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mEntries[packageName] = {PACKAGE_SIZE_UNKNOWN, "", ++mGeneration};
+        queueLocked(packageName, path);
+    }
+    mCond.notify_all();
+}
+
+void PackageSizeCache::queueLocked(const std::string &packageName, const std::string &path) {
+    mQueue.emplace_back(packageName, path);
+    if (!mStarted) {
+        // started on demand, most boots only load sizes from the registry
+        mStarted = createThread(&mThread, "pm_size", [this]() { loop(); }) == 0;
+        if (!mStarted) {
+            ALOGE("no size thread, %s stays unmeasured", packageName.c_str());
+        }
+    }
+}
+
+void PackageSizeCache::erase(const std::string &packageName) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mEntries.erase(packageName);
+}
+
+int64_t PackageSizeCache::get(const std::string &packageName, const std::string &path,
+                              std::string *shasum) {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mEntries.find(packageName);
+        if (it != mEntries.end()) {
+            if (it->second.size >= 0 && shasum) *shasum = it->second.shasum;
+            // a pending entry is already queued, its walk publishes the result
+            return it->second.size;
+        }
+        mEntries[packageName] = {PACKAGE_SIZE_UNKNOWN, "", ++mGeneration};
+        queueLocked(packageName, path);
+    }
+    mCond.notify_all();
+    return PACKAGE_SIZE_UNKNOWN;
+}
+
+void PackageSizeCache::loop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        if (mQueue.empty()) {
+            if (mExit) break;
+            mCond.wait(lock);
+            continue;
+        }
+        if (mExit) break;
+        auto [packageName, path] = std::move(mQueue.front());
+        mQueue.pop_front();
+        auto it = mEntries.find(packageName);
+        if (it == mEntries.end() || it->second.size >= 0) {
+            continue;
+        }
+        uint32_t generation = it->second.generation;
+
+        lock.unlock();
+        int64_t size;
+        std::string shasum;
+        measure(path, &size, &shasum);
+        lock.lock();
+        it = mEntries.find(packageName);
+        if (it == mEntries.end() || it->second.generation != generation) {
+            // reinstalled or removed during the walk, a newer request follows if needed
+            continue;
+        }
+        it->second.size = size;
+        it->second.shasum = shasum;
+        lock.unlock();
+        mOnMeasured(packageName, size, shasum);
+        lock.lock();
+    }
+}
+
+} // namespace pm
+} // namespace os
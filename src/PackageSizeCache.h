@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include "PackageUtils.h"
+
+namespace os {
+namespace pm {
+
+/*
+ * Code size and shasum of each package, measured on a background thread.
+ *
+ * request() queues a walk of the install directory and drops the old value,
+ * the walk reads every file once for both. get() never walks on the calling
+ * thread, it returns PACKAGE_SIZE_UNKNOWN until the queued walk completes.
+ */
+class PackageSizeCache {
+public:
+    using Callback = std::function<void(const std::string &packageName, int64_t size,
+                                        const std::string &shasum)>;
+    /* onMeasured runs on the background thread once a queued walk completes */
+    explicit PackageSizeCache(Callback onMeasured);
+    ~PackageSizeCache();
+    void set(const std::string &packageName, int64_t size, const std::string &shasum);
+    void request(const std::string &packageName, const std::string &path);
+    void erase(const std::string &packageName);
+    int64_t get(const std::string &packageName, const std::string &path,
+                std::string *shasum = nullptr);
+
+private:
+    struct Entry {
+        int64_t size;
+        std::string shasum;
+        uint32_t generation; /* bumped on every change, stale walks are discarded */
+    };
+    void queueLocked(const std::string &packageName, const std::string &path);
+    void loop();
+
+    Callback mOnMeasured;
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::map<std::string, Entry> mEntries;
+    std::deque<std::pair<std::string, std::string>> mQueue;
+    uint32_t mGeneration;
+    bool mExit;
+    pthread_t mThread;
+    bool mStarted;
+}; // class PackageSizeCache
+
+} // namespace pm
+} // namespace os
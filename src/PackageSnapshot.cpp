@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackageSnapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utils/Errors.h>
+#include <utils/Log.h>
+
+#include <unordered_map>
+
+#include "PackageUtils.h"
+
+namespace os {
+namespace pm {
+
+PackageSnapshot::PackageSnapshot() : mData(nullptr), mSize(0), mMapped(false) {}
+
+PackageSnapshot::~PackageSnapshot() {
+    close();
+}
+
+int PackageSnapshot::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return android::NAME_NOT_FOUND;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(SnapshotHeader))) {
+        ALOGE("snapshot %s is truncated", path);
+        ::close(fd);
+        return android::BAD_VALUE;
+    }
+
+    mSize = st.st_size;
+    void *addr = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+        mData = static_cast<uint8_t *>(addr);
+        mMapped = true;
+    } else {
+        // filesystem without mmap support, fall back to a single read
+        mData = static_cast<uint8_t *>(malloc(mSize));
+        if (!mData || read(fd, mData, mSize) != static_cast<ssize_t>(mSize)) {
+            ALOGE("read snapshot %s failed", path);
+            ::close(fd);
+            close();
+            return android::NO_MEMORY;
+        }
+    }
+    ::close(fd);
+
+    int ret = verify();
+    if (ret) {
+        ALOGE("snapshot %s is invalid", path);
+        close();
+    }
+    return ret;
+}
+
+void PackageSnapshot::close() {
+    if (mData) {
+        if (mMapped) {
+            munmap(mData, mSize);
+        } else {
+            free(mData);
+        }
+    }
+    mData = nullptr;
+    mSize = 0;
+    mMapped = false;
+}
+
+int PackageSnapshot::verify() const {
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(mData);
+    if (header->magic != PACKAGE_SNAPSHOT_MAGIC || header->version < PACKAGE_SNAPSHOT_MIN_VERSION ||
+        header->version > PACKAGE_SNAPSHOT_VERSION || header->headerSize != sizeof(SnapshotHeader) ||
+        header->entrySize != sizeof(SnapshotEntry)) {
+        return android::BAD_TYPE;
+    }
+
+    uint64_t entriesEnd = header->entriesOffset + uint64_t(header->count) * header->entrySize;
+    uint64_t stringsEnd = uint64_t(header->stringsOffset) + header->stringsSize;
+    if (header->entriesOffset < header->headerSize || entriesEnd > header->stringsOffset ||
+        stringsEnd != mSize) {
+        return android::BAD_VALUE;
+    }
+
+    if (crc32(mData + header->headerSize, mSize - header->headerSize) != header->checksum) {
+        return android::BAD_VALUE;
+    }
+
+    for (uint32_t i = 0; i < header->count; i++) {
+        const SnapshotEntry &e = entry(i);
+        for (const SnapshotString *str : {&e.packageName, &e.appType, &e.version,
+                                          &e.installedPath, &e.installTime, &e.shasum}) {
+            if (uint64_t(str->offset) + str->length > header->stringsSize) {
+                return android::BAD_VALUE;
+            }
+        }
+    }
+    return 0;
+}
+
+uint32_t PackageSnapshot::count() const {
+    return mData ? reinterpret_cast<const SnapshotHeader *>(mData)->count : 0;
+}
+
+uint32_t PackageSnapshot::checksum() const {
+    return mData ? reinterpret_cast<const SnapshotHeader *>(mData)->checksum : 0;
+}
+
+bool PackageSnapshot::hasAttributes() const {
+    return mData && reinterpret_cast<const SnapshotHeader *>(mData)->version >= 3;
+}
+
+const SnapshotEntry &PackageSnapshot::entry(uint32_t index) const {
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(mData);
+    return reinterpret_cast<const SnapshotEntry *>(mData + header->entriesOffset)[index];
+}
+
+std::string_view PackageSnapshot::getString(const SnapshotString &str) const {
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(mData);
+    return std::string_view(reinterpret_cast<const char *>(mData + header->stringsOffset) +
+                                    str.offset,
+                            str.length);
+}
+
+std::string_view PackageSnapshot::packageName(uint32_t index) const {
+    return getString(entry(index).packageName);
+}
+
+void PackageSnapshot::getPackageInfo(uint32_t index, PackageInfo *info) const {
+    const SnapshotEntry &e = entry(index);
+    info->packageName = getString(e.packageName);
+    info->appType = getString(e.appType);
+    info->version = getString(e.version);
+    info->installedPath = getString(e.installedPath);
+    info->manifest = joinPath(info->installedPath, MANIFEST);
+    info->installTime = getString(e.installTime);
+    info->shasum = getString(e.shasum);
+    info->userId = e.userId;
+    info->size = e.size;
+    info->isSystemUI = hasAttributes() && (e.flags & SNAPSHOT_FLAG_SYSTEM_UI);
+    info->parsedFields = 0;
+}
+
+DirectoryStamp PackageSnapshot::getStamp(uint32_t index) const {
+    return entry(index).stamp;
+}
+
+int PackageSnapshot::write(const char *path, const std::vector<PackageInfo> &pkgInfos,
+                           const std::vector<DirectoryStamp> &stamps, uint32_t *checksum) {
+    std::string strings;
+    std::unordered_map<std::string_view, uint32_t> offsets;
+    auto addString = [&strings, &offsets](const std::string &str) {
+        // identical strings, appType for example, are stored once
+        auto it = offsets.find(str);
+        if (it != offsets.end()) {
+            return SnapshotString{it->second, static_cast<uint32_t>(str.length())};
+        }
+        uint32_t offset = strings.length();
+        strings.append(str);
+        strings.push_back('\0');
+        offsets.emplace(str, offset);
+        return SnapshotString{offset, static_cast<uint32_t>(str.length())};
+    };
+
+    std::vector<SnapshotEntry> entries;
+    entries.reserve(pkgInfos.size());
+    for (size_t i = 0; i < pkgInfos.size(); i++) {
+        const PackageInfo &info = pkgInfos[i];
+        SnapshotEntry e = {};
+        e.packageName = addString(info.packageName);
+        e.appType = addString(info.appType);
+        e.version = addString(info.version);
+        e.installedPath = addString(info.installedPath);
+        e.installTime = addString(info.installTime);
+        e.shasum = addString(info.shasum);
+        e.userId = info.userId;
+        e.flags = info.isSystemUI ? SNAPSHOT_FLAG_SYSTEM_UI : 0;
+        e.size = info.size;
+        if (i < stamps.size()) {
+            e.stamp = stamps[i];
+        }
+        entries.push_back(e);
+    }
+
+    SnapshotHeader header = {};
+    header.magic = PACKAGE_SNAPSHOT_MAGIC;
+    header.version = PACKAGE_SNAPSHOT_VERSION;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.count = entries.size();
+    header.entrySize = sizeof(SnapshotEntry);
+    header.entriesOffset = sizeof(SnapshotHeader);
+    header.stringsOffset = header.entriesOffset + entries.size() * sizeof(SnapshotEntry);
+    header.stringsSize = strings.length();
+
+    std::string data;
+    data.reserve(header.stringsOffset + header.stringsSize);
+    data.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    data.append(reinterpret_cast<const char *>(entries.data()),
+                entries.size() * sizeof(SnapshotEntry));
+    data.append(strings);
+    header.checksum = crc32(reinterpret_cast<const uint8_t *>(data.data()) + sizeof(header),
+                            data.length() - sizeof(header));
+    data.replace(0, sizeof(header), reinterpret_cast<const char *>(&header), sizeof(header));
+    if (checksum) {
+        *checksum = header.checksum;
+    }
+    return writeFile(path, data);
+}
+
+} // namespace pm
+} // namespace os
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "PackageUtils.h"
+#include "pm/PackageInfo.h"
+
+namespace os {
+namespace pm {
+
+/*
+ * Binary registry of installed packages, it's the on-disk form of packages.list.
+ *
+ * layout: SnapshotHeader | SnapshotEntry[count] | string table
+ * Entries are fixed size and refer to their strings by offset into the string
+ * table, so a mapped snapshot can be read in place without any parsing.
+ */
+#define PACKAGE_SNAPSHOT_MAGIC 0x534b4750 /* "PGKS" */
+#define PACKAGE_SNAPSHOT_VERSION 3
+/* version 2 entries are laid out the same, but their flags were never written */
+#define PACKAGE_SNAPSHOT_MIN_VERSION 2
+
+#define SNAPSHOT_FLAG_SYSTEM_UI (1u << 0)
+
+struct SnapshotString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t count;
+    uint32_t entrySize;
+    uint32_t entriesOffset;
+    uint32_t stringsOffset;
+    uint32_t stringsSize;
+    uint32_t checksum; /* crc32 of everything after the header */
+};
+
+struct SnapshotEntry {
+    SnapshotString packageName;
+    SnapshotString appType;
+    SnapshotString version;
+    SnapshotString installedPath;
+    SnapshotString installTime;
+    SnapshotString shasum;
+    int32_t userId;
+    uint32_t flags;
+    int64_t size;
+    DirectoryStamp stamp; /* stamp of installedPath when the entry was recorded */
+};
+
+class PackageSnapshot {
+public:
+    PackageSnapshot();
+    ~PackageSnapshot();
+    int open(const char *path);
+    void close();
+    uint32_t count() const;
+    uint32_t checksum() const;
+    /* False for snapshots written before manifest attributes were kept in the flags. */
+    bool hasAttributes() const;
+    std::string_view packageName(uint32_t index) const;
+    void getPackageInfo(uint32_t index, PackageInfo *info) const;
+    DirectoryStamp getStamp(uint32_t index) const;
+    static int write(const char *path, const std::vector<PackageInfo> &pkgInfos,
+                     const std::vector<DirectoryStamp> &stamps, uint32_t *checksum = nullptr);
+
+private:
+    const SnapshotEntry &entry(uint32_t index) const;
+    std::string_view getString(const SnapshotString &str) const;
+    int verify() const;
+
+    uint8_t *mData;
+    size_t mSize;
+    bool mMapped;
+}; // class PackageSnapshot
+
+} // namespace pm
+} // namespace os
@@ -16,26 +16,31 @@
 
 #include "PackageUtils.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <rapidjson/prettywriter.h>
 #include <rapidjson/stringbuffer.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <utils/Errors.h>
 #include <utils/Log.h>
 
+#include <atomic>
 #include <chrono>
 #include <ctime>
-#include <fstream>
 #include <iomanip>
+#include <memory>
 #include <sstream>
 
+#include "PackageDigest.h"
+
 namespace os {
 namespace pm {
 
 using rapidjson::PrettyWriter;
 using rapidjson::StringBuffer;
 using std::error_code;
-using std::ifstream;
-using std::ofstream;
 using std::chrono::system_clock;
 using std::filesystem::create_directories;
 using std::filesystem::directory_iterator;
@@ -46,11 +51,15 @@ using std::filesystem::recursive_directory_iterator;
 
 PackageConfig::PackageConfig() {
     rapidjson::Document doc;
-    getDocument(PACKAGE_CFG, doc);
+    FileBuffer buffer;
+    getDocument(PACKAGE_CFG, doc, &buffer);
     mAppPresetPath = getValue<std::string>(doc, "appPresetPath", "/system/app");
     mAppInstalledPath = getValue<std::string>(doc, "appInstalledPath", "/data/app");
     mAppDataPath = getValue<std::string>(doc, "appDataPath", "/data/data");
     mPackageListPath = joinPath(mAppInstalledPath, PACKAGE_LIST);
+    mPackageSnapshotPath = joinPath(mAppInstalledPath, PACKAGE_SNAPSHOT);
+    mPackageJournalPath = joinPath(mAppInstalledPath, PACKAGE_JOURNAL);
+    mManifestCachePath = joinPath(mAppInstalledPath, MANIFEST_CACHE);
 }
 
 PackageConfig &PackageConfig::getInstance() {
@@ -74,6 +83,18 @@ std::string PackageConfig::getPackageListPath() {
     return mPackageListPath;
 }
 
+std::string PackageConfig::getPackageSnapshotPath() {
+    return mPackageSnapshotPath;
+}
+
+std::string PackageConfig::getPackageJournalPath() {
+    return mPackageJournalPath;
+}
+
+std::string PackageConfig::getManifestCachePath() {
+    return mManifestCachePath;
+}
+
 std::string getCurrentTime() {
     const auto finish = system_clock::to_time_t(system_clock::now());
     std::tm finish_tm;
@@ -140,35 +161,168 @@ bool removeDirectory(const char *path) {
     return ret ? false : true;
 }
 
+static bool readFully(int fd, void *data, size_t size) {
+    char *ptr = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, ptr, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+        ptr += n;
+        size -= n;
+    }
+    return size == 0;
+}
+
 int readFile(const char *filename, std::string &content) {
-    ifstream file(filename);
-    if (!file.is_open()) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         ALOGE("Failed to open file %s", filename);
         return android::NAME_NOT_FOUND;
     }
-    std::ostringstream tmp;
-    tmp << file.rdbuf();
-    content = tmp.str();
-    file.close();
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return android::UNKNOWN_ERROR;
+    }
+    content.resize(st.st_size);
+    bool ok = readFully(fd, content.data(), content.length());
+    close(fd);
+    if (!ok) {
+        ALOGE("Failed to read file %s", filename);
+        return android::UNKNOWN_ERROR;
+    }
     return 0;
 }
 
+FileBuffer::FileBuffer()
+      : mData(nullptr), mSize(0), mMapped(false), mBuffer(nullptr), mCapacity(0) {}
+
+FileBuffer::~FileBuffer() {
+    release();
+    free(mBuffer);
+}
+
+int FileBuffer::load(const char *path) {
+    release();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("Failed to open file %s", path);
+        return android::NAME_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return android::UNKNOWN_ERROR;
+    }
+
+    mSize = st.st_size;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (mSize > 0 && pageSize > 0 && mSize % pageSize != 0) {
+        // the zero filled tail of the last page terminates the text for in-situ parsing
+        void *addr = mmap(nullptr, mSize + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED && static_cast<char *>(addr)[mSize] == '\0') {
+            mData = static_cast<char *>(addr);
+            mMapped = true;
+            close(fd);
+            return 0;
+        }
+        if (addr != MAP_FAILED) {
+            munmap(addr, mSize + 1);
+        }
+    }
+
+    // filesystem without mmap support or a page aligned file, read once into the buffer
+    if (mSize + 1 > mCapacity) {
+        char *buffer = static_cast<char *>(realloc(mBuffer, mSize + 1));
+        if (buffer == nullptr) {
+            close(fd);
+            mSize = 0;
+            return android::NO_MEMORY;
+        }
+        mBuffer = buffer;
+        mCapacity = mSize + 1;
+    }
+    bool ok = readFully(fd, mBuffer, mSize);
+    close(fd);
+    if (!ok) {
+        ALOGE("Failed to read file %s", path);
+        mSize = 0;
+        return android::UNKNOWN_ERROR;
+    }
+    mBuffer[mSize] = '\0';
+    mData = mBuffer;
+    return 0;
+}
+
+void FileBuffer::release() {
+    if (mMapped) {
+        munmap(mData, mSize + 1);
+    }
+    mData = nullptr;
+    mSize = 0;
+    mMapped = false;
+}
+
+bool writeFully(int fd, const void *data, size_t size) {
+    const char *ptr = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void syncDirectory(const std::string &path) {
+    int fd = open(path.empty() ? "." : path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    // not every filesystem can sync a directory, the rename is still atomic there
+    if (fsync(fd) < 0) {
+        ALOGD("sync directory %s failed:%d", path.c_str(), errno);
+    }
+    close(fd);
+}
+
 int writeFile(const char *filename, const std::string &data) {
     std::filesystem::path fullPath(filename);
     std::filesystem::path parent = fullPath.parent_path();
-    if (!exists(parent)) {
+    if (!parent.empty() && !exists(parent)) {
         if (!createDirectory(parent.string().c_str())) {
             ALOGE("writeFile failed at create parent directory:%s", parent.string().c_str());
             return android::PERMISSION_DENIED;
         }
     }
-    ofstream file(filename);
-    if (!file) {
-        ALOGE("Failed to open file %s", filename);
+
+    // write a sibling and rename it over the target, a power cut leaves either copy intact
+    std::string tmpName = std::string(filename) + ".tmp";
+    int fd = open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        ALOGE("Failed to open file %s:%d", tmpName.c_str(), errno);
         return android::NAME_NOT_FOUND;
     }
-    file << data;
-    file.close();
+    if (!writeFully(fd, data.data(), data.length()) || fsync(fd) < 0) {
+        ALOGE("Failed to write file %s:%d", tmpName.c_str(), errno);
+        close(fd);
+        unlink(tmpName.c_str());
+        return android::UNKNOWN_ERROR;
+    }
+    close(fd);
+
+    if (rename(tmpName.c_str(), filename) < 0) {
+        ALOGE("Failed to rename %s to %s:%d", tmpName.c_str(), filename, errno);
+        unlink(tmpName.c_str());
+        return android::UNKNOWN_ERROR;
+    }
+    syncDirectory(parent.string());
     return 0;
 }
 
@@ -212,13 +366,26 @@ bool hasMember(const rapidjson::Value &parent, const std::string &name) {
 }
 
 int getDocument(const char *path, rapidjson::Document &document) {
-    std::string content;
-    int ret = readFile(path, content);
+    FileBuffer buffer;
+    int ret = buffer.load(path);
+    if (ret < 0) {
+        ALOGE("read file %s failed", path);
+        return ret;
+    }
+    if (document.Parse(buffer.data()).HasParseError()) {
+        ALOGE("parse file %s failed,is not json format", path);
+        return android::BAD_VALUE;
+    }
+    return 0;
+}
+
+int getDocument(const char *path, rapidjson::Document &document, FileBuffer *buffer) {
+    int ret = buffer->load(path);
     if (ret < 0) {
         ALOGE("read file %s failed", path);
         return ret;
     }
-    if (document.Parse(content.c_str()).HasParseError()) {
+    if (document.ParseInsitu(buffer->data()).HasParseError()) {
         ALOGE("parse file %s failed,is not json format", path);
         return android::BAD_VALUE;
     }
@@ -233,8 +400,204 @@ std::string toPrettyString(const rapidjson::Document &doc) {
 }
 
 std::string calculateShasum(const char *path) {
-    // TODO
-    return "";
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    if (sha256Path(path, digest)) {
+        return "";
+    }
+    return Sha256::toHex(digest);
+}
+
+uint32_t crc32(const void *data, size_t size) {
+    static uint32_t table[256];
+    static bool initialized = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)initialized;
+
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+uint64_t hashBytes(const void *data, size_t size) {
+    // FNV-1a
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int getFileStamp(const char *path, FileStamp *stamp) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        return android::NAME_NOT_FOUND;
+    }
+    stamp->mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    stamp->size = st.st_size;
+    stamp->inode = st.st_ino;
+    stamp->hash = 0;
+    if (S_ISREG(st.st_mode)) {
+        FileBuffer content;
+        int ret = content.load(path);
+        if (ret) return ret;
+        stamp->hash = hashBytes(content.data(), content.size());
+    }
+    return 0;
+}
+
+int getDirectoryStamp(const char *path, DirectoryStamp *stamp) {
+    FileStamp dir, manifest;
+    int ret = getFileStamp(path, &dir);
+    if (ret) return ret;
+    ret = getFileStamp(joinPath(path, MANIFEST).c_str(), &manifest);
+    if (ret) return ret;
+    stamp->mtime = dir.mtime;
+    stamp->inode = dir.inode;
+    stamp->manifestHash = manifest.hash;
+    return 0;
+}
+
+void ByteWriter::writeInt32(int32_t value) {
+    mOut->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void ByteWriter::writeInt64(int64_t value) {
+    mOut->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void ByteWriter::writeBool(bool value) {
+    mOut->push_back(value ? 1 : 0);
+}
+
+void ByteWriter::writeString(const std::string &value) {
+    writeInt32(value.length());
+    mOut->append(value);
+}
+
+void ByteWriter::writeStringVector(const std::vector<std::string> &value) {
+    writeInt32(value.size());
+    for (const auto &str : value) {
+        writeString(str);
+    }
+}
+
+bool ByteReader::read(void *value, size_t size) {
+    if (size > mSize - mPos) {
+        mPos = mSize;
+        return false;
+    }
+    memcpy(value, mData + mPos, size);
+    mPos += size;
+    return true;
+}
+
+bool ByteReader::readInt32(int32_t *value) {
+    return read(value, sizeof(*value));
+}
+
+bool ByteReader::readInt64(int64_t *value) {
+    return read(value, sizeof(*value));
+}
+
+bool ByteReader::readBool(bool *value) {
+    char c;
+    if (!read(&c, 1)) return false;
+    *value = c != 0;
+    return true;
+}
+
+bool ByteReader::readString(std::string *value) {
+    int32_t length;
+    if (!readInt32(&length) || length < 0 || static_cast<size_t>(length) > mSize - mPos) {
+        mPos = mSize;
+        return false;
+    }
+    value->assign(mData + mPos, length);
+    mPos += length;
+    return true;
+}
+
+bool ByteReader::readStringVector(std::vector<std::string> *value) {
+    int32_t count;
+    if (!readInt32(&count) || count < 0) return false;
+    value->clear();
+    for (int32_t i = 0; i < count; i++) {
+        std::string str;
+        if (!readString(&str)) return false;
+        value->push_back(std::move(str));
+    }
+    return true;
+}
+
+int createThread(pthread_t *tid, const char *name, std::function<void()> func) {
+    auto routine = [](void *arg) -> void * {
+        std::unique_ptr<std::function<void()>> task(static_cast<std::function<void()> *>(arg));
+        (*task)();
+        return nullptr;
+    };
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, CONFIG_DEFAULT_TASK_STACKSIZE);
+    auto *task = new std::function<void()>(std::move(func));
+    int ret = pthread_create(tid, &attr, routine, task);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        ALOGE("create thread %s failed:%d", name, ret);
+        delete task;
+        return -ret;
+    }
+    pthread_setname_np(*tid, name);
+    return 0;
+}
+
+void parallelFor(size_t count, int concurrency, const std::function<void(size_t)> &func) {
+    struct Context {
+        std::atomic<size_t> next;
+        size_t count;
+        const std::function<void(size_t)> *func;
+    } ctx{{0}, count, &func};
+
+    auto worker = [](void *arg) -> void * {
+        Context *c = static_cast<Context *>(arg);
+        for (size_t i = c->next++; i < c->count; i = c->next++) {
+            (*c->func)(i);
+        }
+        return nullptr;
+    };
+
+    size_t threads = concurrency > 1 ? std::min(count, static_cast<size_t>(concurrency)) : 1;
+    std::vector<pthread_t> tids;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, CONFIG_DEFAULT_TASK_STACKSIZE);
+    for (size_t i = 1; i < threads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, worker, &ctx) != 0) {
+            ALOGW("parallelFor create worker failed, continue with %zu threads", tids.size() + 1);
+            break;
+        }
+        tids.push_back(tid);
+    }
+    pthread_attr_destroy(&attr);
+
+    worker(&ctx);
+    for (auto tid : tids) {
+        pthread_join(tid, nullptr);
+    }
 }
 
 } // namespace pm
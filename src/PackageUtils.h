@@ -16,10 +16,12 @@
 
 #pragma once
 
+#include <pthread.h>
 #include <rapidjson/document.h>
 #include <rapidjson/rapidjson.h>
 
 #include <filesystem>
+#include <functional>
 #include <iostream>
 #include <vector>
 
@@ -30,6 +32,11 @@ namespace pm {
 #define MANIFEST "manifest.json"
 #define PACKAGE_CFG "/etc/package.cfg"
 #define PACKAGE_LIST "packages.list"
+#define PACKAGE_SNAPSHOT "packages.bin"
+#define PACKAGE_JOURNAL "packages.journal"
+#define MANIFEST_CACHE "manifests.cache"
+/* PackageInfo::size of a package whose directory hasn't been measured yet */
+#define PACKAGE_SIZE_UNKNOWN (-1)
 
 class PackageConfig {
 public:
@@ -38,6 +45,9 @@ public:
     std::string getAppInstalledPath();
     std::string getAppDataPath();
     std::string getPackageListPath();
+    std::string getPackageSnapshotPath();
+    std::string getPackageJournalPath();
+    std::string getManifestCachePath();
 
 private:
     PackageConfig();
@@ -45,6 +55,102 @@ private:
     std::string mAppInstalledPath;
     std::string mAppDataPath;
     std::string mPackageListPath;
+    std::string mPackageSnapshotPath;
+    std::string mPackageJournalPath;
+    std::string mManifestCachePath;
+};
+
+struct FileStamp {
+    int64_t mtime; /* nanoseconds */
+    int64_t size;
+    int64_t inode;
+    uint64_t hash; /* content hash, regular file only */
+
+    bool operator==(const FileStamp &other) const {
+        return mtime == other.mtime && size == other.size && inode == other.inode &&
+                hash == other.hash;
+    }
+    bool operator!=(const FileStamp &other) const {
+        return !(*this == other);
+    }
+};
+
+struct DirectoryStamp {
+    int64_t mtime; /* nanoseconds */
+    int64_t inode;
+    uint64_t manifestHash;
+
+    bool operator==(const DirectoryStamp &other) const {
+        return mtime == other.mtime && inode == other.inode && manifestHash == other.manifestHash;
+    }
+    bool operator!=(const DirectoryStamp &other) const {
+        return !(*this == other);
+    }
+};
+
+/* Append-only binary encoder, values are stored in host byte order. */
+class ByteWriter {
+public:
+    explicit ByteWriter(std::string *out) : mOut(out) {}
+    void writeInt32(int32_t value);
+    void writeInt64(int64_t value);
+    void writeBool(bool value);
+    void writeString(const std::string &value);
+    void writeStringVector(const std::vector<std::string> &value);
+
+private:
+    std::string *mOut;
+};
+
+class ByteReader {
+public:
+    ByteReader(const char *data, size_t size) : mData(data), mSize(size), mPos(0) {}
+    bool readInt32(int32_t *value);
+    bool readInt64(int64_t *value);
+    bool readBool(bool *value);
+    bool readString(std::string *value);
+    bool readStringVector(std::vector<std::string> *value);
+    size_t position() const {
+        return mPos;
+    }
+    bool eof() const {
+        return mPos >= mSize;
+    }
+
+private:
+    bool read(void *value, size_t size);
+    const char *mData;
+    size_t mSize;
+    size_t mPos;
+};
+
+/*
+ * A whole file loaded for in-situ parsing and always followed by a NUL. The file is mapped
+ * copy-on-write when the tail of its last page can hold the NUL, otherwise it is read once
+ * into a buffer that later loads reuse. A document parsed in situ borrows its strings from
+ * here, keep the buffer alive and loaded as long as the document.
+ */
+class FileBuffer {
+public:
+    FileBuffer();
+    ~FileBuffer();
+    FileBuffer(const FileBuffer &) = delete;
+    FileBuffer &operator=(const FileBuffer &) = delete;
+    int load(const char *path);
+    void release();
+    char *data() const {
+        return mData;
+    }
+    size_t size() const {
+        return mSize;
+    }
+
+private:
+    char *mData;
+    size_t mSize;
+    bool mMapped;
+    char *mBuffer;
+    size_t mCapacity;
 };
 
 std::string getCurrentTime();
@@ -53,12 +159,24 @@ bool removeDirectory(const char *path);
 int64_t getDirectorySize(const char *path);
 std::vector<std::string> getChildDirectories(const char *path);
 int readFile(const char *filename, std::string &content);
+/* Replace filename with data atomically, the previous content survives a power cut. */
 int writeFile(const char *filename, const std::string &data);
+bool writeFully(int fd, const void *data, size_t size);
 std::string joinPath(std::string basic, std::string suffix);
 bool hasMember(const rapidjson::Value &parent, const std::string &name);
 int getDocument(const char *path, rapidjson::Document &document);
+/* Parse in situ, the document borrows its strings from buffer. */
+int getDocument(const char *path, rapidjson::Document &document, FileBuffer *buffer);
 std::string toPrettyString(const rapidjson::Document &doc);
 std::string calculateShasum(const char *path);
+uint32_t crc32(const void *data, size_t size);
+uint64_t hashBytes(const void *data, size_t size);
+int getFileStamp(const char *path, FileStamp *stamp);
+int getDirectoryStamp(const char *path, DirectoryStamp *stamp);
+/* Start a joinable thread with the default task stack size. */
+int createThread(pthread_t *tid, const char *name, std::function<void()> func);
+/* Run func(0) .. func(count - 1) on at most concurrency threads, the caller included. */
+void parallelFor(size_t count, int concurrency, const std::function<void(size_t)> &func);
 
 template <typename T>
 T getValue(const rapidjson::Value &parent, const std::string &key, const T &defaultValue) {
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2024 Xiaomi Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <binder/Parcel.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <vector>
+
+#include "../src/PackageDigest.h"
+#include "../src/PackageManifestReader.h"
+#include "../src/PackageParser.h"
+#include "../src/PackageRegistry.h"
+#include "../src/PackageUtils.h"
+#include "pm/PackageInfo.h"
+
+using namespace os::pm;
+
+static double elapsedSeconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void benchSha256(size_t megabytes) {
+    std::vector<uint8_t> buffer(64 * 1024);
+    for (size_t i = 0; i < buffer.size(); i++) {
+        buffer[i] = i * 131 + 7;
+    }
+    size_t rounds = megabytes * 1024 * 1024 / buffer.size();
+
+    const Sha256::Backend backends[] = {Sha256::BACKEND_PORTABLE, Sha256::BACKEND_SHA_NI,
+                                        Sha256::BACKEND_ARMV8};
+    for (auto backend : backends) {
+        if (!Sha256::isSupported(backend)) {
+            printf("sha256 %-10s unsupported\n", Sha256::backendName(backend));
+            continue;
+        }
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        Sha256 sha(backend);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; i++) {
+            sha.update(buffer.data(), buffer.size());
+        }
+        sha.finish(digest);
+        double seconds = elapsedSeconds(start);
+        printf("sha256 %-10s %8.2f MB/s  %s\n", Sha256::backendName(backend),
+               megabytes / seconds, Sha256::toHex(digest).substr(0, 16).c_str());
+    }
+}
+
+static void benchShasum(const char *path) {
+    auto start = std::chrono::steady_clock::now();
+    std::string shasum = calculateShasum(path);
+    double seconds = elapsedSeconds(start);
+    int64_t size = std::filesystem::is_directory(path) ? getDirectorySize(path)
+                                                       : std::filesystem::file_size(path);
+    printf("shasum %s: %s\n", path, shasum.c_str());
+    printf("shasum %" PRId64 " bytes in %.3f s, %.2f MB/s\n", size, seconds,
+           size / seconds / 1024 / 1024);
+}
+
+static PackageInfo makeQuickApp(int pages) {
+    PackageInfo info;
+    info.packageName = "com.vela.benchmark.quickapp";
+    info.name = "Benchmark";
+    info.icon = "/Common/logo.png";
+    info.execfile = "vappxms";
+    info.entry = "QuickActivity";
+    info.installedPath = "/data/app/com.vela.benchmark.quickapp";
+    info.manifest = joinPath(info.installedPath, MANIFEST);
+    info.appType = "QUICKAPP";
+    info.version = "1.0.0";
+    info.shasum = std::string(64, 'a');
+    info.installTime = "1700000000000";
+    info.priority = ProcessPriority::MIDDLE;
+    info.userId = 10000;
+    info.size = 1 << 20;
+    info.isSystemUI = false;
+    info.parsedFields = PACKAGE_FIELD_MANIFEST;
+    ActivityInfo activity;
+    activity.name = "QuickActivity";
+    activity.launchMode = "singleTask";
+    activity.taskAffinity = info.packageName;
+    activity.actions.push_back("vela.intent.action.VIEW");
+    info.activitiesInfo.push_back(activity);
+    QuickAppInfo quickapp;
+    quickapp.versionCode = 1;
+    quickapp.router.entry = "pages/index";
+    for (int i = 0; i < pages; i++) {
+        PageInfo page;
+        page.pageName = "pages/page" + std::to_string(i);
+        quickapp.router.pages.push_back(page);
+    }
+    info.extra = quickapp;
+    return info;
+}
+
+static void benchParcel(int rounds) {
+    const PackageInfo source = makeQuickApp(16);
+    const struct {
+        const char *name;
+        int32_t encoding;
+    } encodings[] = {{"utf16", PACKAGE_ENCODING_UTF16}, {"compact", PACKAGE_ENCODING_COMPACT}};
+    for (const auto &encoding : encodings) {
+        PackageInfo info;
+        info.assignFields(source, withPackageEncoding(PACKAGE_FIELD_ALL, encoding.encoding));
+        android::Parcel parcel;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            parcel.setDataPosition(0);
+            info.writeToParcel(&parcel);
+        }
+        double encodeSeconds = elapsedSeconds(start);
+        PackageInfo decoded;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            parcel.setDataPosition(0);
+            decoded.readFromParcel(&parcel);
+        }
+        double decodeSeconds = elapsedSeconds(start);
+        printf("parcel %-8s %6zu bytes  encode %7.2f us  decode %7.2f us\n", encoding.name,
+               parcel.dataSize(), encodeSeconds * 1e6 / rounds, decodeSeconds * 1e6 / rounds);
+    }
+}
+
+static std::string makeQuickAppManifest(int pages) {
+    std::string json = R"({"package":"com.vela.benchmark.quickapp","name":"Benchmark",)"
+                       R"("icon":"/Common/logo.png","versionName":"1.0.0","versionCode":1,)"
+                       R"("minPlatformVersion":1000,"permissions":[{"name":"system.network"}],)"
+                       R"("features":[{"name":"system.router"},{"name":"system.storage"}],)"
+                       R"("router":{"entry":"pages/index","pages":{)";
+    for (int i = 0; i < pages; i++) {
+        json += (i ? "," : "") + std::string(R"("pages/page)") + std::to_string(i) +
+                R"(":{"component":"index","path":"/page)" + std::to_string(i) + R"("})";
+    }
+    json += R"(}},"display":{"titleBar":false,"backgroundColor":"#000000"}})";
+    return json;
+}
+
+static void benchManifest(const char *path, int rounds) {
+    std::string json;
+    if (path == nullptr) {
+        json = makeQuickAppManifest(16);
+    } else if (readFile(path, json) < 0) {
+        printf("read %s failed\n", path);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        PackageInfo info;
+        rapidjson::Document document;
+        if (document.Parse(json.c_str()).HasParseError() ||
+            PackageParser::parseDocument(document, &info)) {
+            printf("manifest is invalid\n");
+            return;
+        }
+    }
+    double domSeconds = elapsedSeconds(start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        PackageInfo info;
+        PackageManifestReader::parse(json.c_str(), &info);
+    }
+    double saxSeconds = elapsedSeconds(start);
+    printf("manifest %zu bytes  dom %7.2f us  sax %7.2f us  %.2fx\n", json.length(),
+           domSeconds * 1e6 / rounds, saxSeconds * 1e6 / rounds, domSeconds / saxSeconds);
+}
+
+static void benchRegistry(int count, int rounds) {
+    std::vector<std::string> names;
+    std::map<std::string, std::shared_ptr<const PackageInfo>> tree;
+    PackageRegistry registry;
+    registry.update([&](PackageRegistry::Writer &writer) {
+        for (int i = 0; i < count; i++) {
+            auto info = std::make_shared<PackageInfo>();
+            info->packageName = "com.vela.benchmark.app" + std::to_string(i);
+            names.push_back(info->packageName);
+            tree[info->packageName] = info;
+            writer.put(info);
+        }
+    });
+
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        for (const auto &name : names) {
+            found += tree.find(name) != tree.end();
+        }
+    }
+    double mapSeconds = elapsedSeconds(start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        auto snapshot = registry.read();
+        for (const auto &name : names) {
+            found += snapshot->lookup(name) != PACKAGE_HANDLE_INVALID;
+        }
+    }
+    double flatSeconds = elapsedSeconds(start);
+    double lookups = static_cast<double>(rounds) * names.size();
+    printf("registry %d packages  map %7.1f ns  flat %7.1f ns  (%zu found)\n", count,
+           mapSeconds * 1e9 / lookups, flatSeconds * 1e9 / lookups, found);
+}
+
+extern "C" int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "parcel") == 0) {
+        benchParcel(argc > 2 ? atoi(argv[2]) : 1000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "manifest") == 0) {
+        benchManifest(argc > 2 ? argv[2] : nullptr, argc > 3 ? atoi(argv[3]) : 1000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "registry") == 0) {
+        benchRegistry(argc > 2 ? atoi(argv[2]) : 2000, argc > 3 ? atoi(argv[3]) : 100);
+        return 0;
+    }
+    if (argc > 1 && (argv[1][0] < '0' || argv[1][0] > '9')) {
+        // a package archive or directory, measure the whole shasum path
+        benchShasum(argv[1]);
+        return 0;
+    }
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 16;
+    benchSha256(megabytes > 0 ? megabytes : 16);
+    return 0;
+}
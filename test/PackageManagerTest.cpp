@@ -14,13 +14,23 @@
  * limitations under the License.
  */
 
+#include <binder/Parcel.h>
 #include <binder/ProcessState.h>
 #include <gtest/gtest.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cinttypes>
 #include <filesystem>
 #include <future>
 #include <memory>
 
+#include "../src/PackageChangeNotifier.h"
+#include "../src/PackageDigest.h"
+#include "../src/PackageFlusher.h"
+#include "../src/PackageManifestReader.h"
+#include "../src/PackageParser.h"
+#include "../src/PackageSnapshot.h"
 #include "../src/PackageUtils.h"
 #include "pm/PackageManager.h"
 
@@ -65,6 +75,7 @@ public:
 class InstallListenerTest : public BnInstallObserver, public std::promise<int32_t> {
 public:
     Status onInstallProcess(const std::string &packageName, int32_t process) override {
+        mProcess = process;
         return Status::ok();
     }
 
@@ -74,6 +85,26 @@ public:
         this->set_value(code);
         return Status::ok();
     }
+
+    int32_t mProcess = 0;
+};
+
+class ChangeListenerTest : public BnPackageChangeObserver,
+                           public std::promise<PackageChangeEvent> {
+public:
+    Status onPackagesChanged(const PackageChangeEvent &event) override {
+        // batches are coalesced by timing, only the first one is checked
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mReceived) {
+            mReceived = true;
+            this->set_value(event);
+        }
+        return Status::ok();
+    }
+
+private:
+    std::mutex mLock;
+    bool mReceived = false;
 };
 
 class UninstallListenerTest : public BnUninstallObserver, public std::promise<int32_t> {
@@ -102,6 +133,18 @@ TEST_F(PmTest, InitStart) {
     EXPECT_EQ(manifestCount, pkgInfos.size());
 }
 
+TEST_F(PmTest, SnapshotMatchesList) {
+    PackageSnapshot snapshot;
+    ASSERT_EQ(snapshot.open(PackageConfig::getInstance().getPackageSnapshotPath().c_str()), 0);
+    std::vector<PackageInfo> pkgInfos;
+    pm.getAllPackageInfo(&pkgInfos);
+    EXPECT_EQ(snapshot.count(), pkgInfos.size());
+    for (uint32_t i = 0; i < snapshot.count(); i++) {
+        PackageInfo info;
+        EXPECT_EQ(pm.getPackageInfo(std::string(snapshot.packageName(i)), &info), 0);
+    }
+}
+
 TEST_F(PmTest, CheckKeyField) {
     std::vector<PackageInfo> pkgInfos;
     pm.getAllPackageInfo(&pkgInfos);
@@ -116,12 +159,343 @@ TEST_F(PmTest, CheckKeyField) {
     }
 }
 
+TEST_F(PmTest, GetPackageNamesFilter) {
+    std::vector<PackageInfo> pkgInfos;
+    pm.getAllPackageInfo(&pkgInfos);
+    std::vector<std::string> pkgNames;
+    EXPECT_EQ(pm.getAllPackageName(&pkgNames), 0);
+    EXPECT_EQ(pkgNames.size(), pkgInfos.size());
+    // both enumerate in package name order
+    EXPECT_TRUE(std::is_sorted(pkgNames.begin(), pkgNames.end()));
+    for (size_t i = 0; i < pkgNames.size() && i < pkgInfos.size(); i++) {
+        EXPECT_STREQ(pkgNames[i].c_str(), pkgInfos[i].packageName.c_str());
+    }
+
+    PackageFilter filter;
+    filter.systemUI = PackageFilter::SYSTEM_UI_ONLY;
+    std::vector<std::string> systemUI;
+    EXPECT_EQ(pm.getPackageNames(filter, &systemUI), 0);
+    filter.systemUI = PackageFilter::SYSTEM_UI_EXCLUDE;
+    std::vector<std::string> others;
+    EXPECT_EQ(pm.getPackageNames(filter, &others), 0);
+    EXPECT_EQ(systemUI.size() + others.size(), pkgNames.size());
+    for (const auto &info : pkgInfos) {
+        bool listed = std::find(systemUI.begin(), systemUI.end(), info.packageName) !=
+                systemUI.end();
+        EXPECT_EQ(listed, info.isSystemUI);
+    }
+}
+
+TEST_F(PmTest, QueryIntentActivities) {
+    std::vector<PackageInfo> pkgInfos;
+    pm.getAllPackageInfo(&pkgInfos);
+    for (const auto &info : pkgInfos) {
+        for (const auto &activity : info.activitiesInfo) {
+            for (const auto &action : activity.actions) {
+                std::vector<ResolveInfo> resolveInfos;
+                EXPECT_EQ(pm.queryIntentActivities(action, &resolveInfos), 0);
+                auto it = std::find_if(resolveInfos.begin(), resolveInfos.end(),
+                                       [&](const ResolveInfo &resolveInfo) {
+                                           return resolveInfo.packageName == info.packageName &&
+                                                   resolveInfo.activityInfo &&
+                                                   resolveInfo.activityInfo->name ==
+                                                           activity.name;
+                                       });
+                EXPECT_NE(it, resolveInfos.end());
+            }
+        }
+    }
+    ResolveInfo resolveInfo;
+    EXPECT_NE(pm.resolveActivity("action.not.declared.anywhere", &resolveInfo), 0);
+}
+
+TEST_F(PmTest, CursorMatchesGetAll) {
+    std::vector<PackageInfo> pkgInfos;
+    pm.getAllPackageInfo(&pkgInfos);
+    int32_t cursor;
+    ASSERT_EQ(pm.openPackageCursor(PACKAGE_FIELD_LABEL, &cursor), 0);
+    size_t fetched = 0;
+    for (;;) {
+        std::vector<PackageInfo> chunk;
+        ASSERT_EQ(pm.fetchPackages(cursor, 3, &chunk), 0);
+        if (chunk.empty()) {
+            break;
+        }
+        EXPECT_LE(chunk.size(), 3u);
+        fetched += chunk.size();
+    }
+    EXPECT_EQ(fetched, pkgInfos.size());
+    EXPECT_EQ(pm.closePackageCursor(cursor), 0);
+    std::vector<PackageInfo> chunk;
+    EXPECT_NE(pm.fetchPackages(cursor, 3, &chunk), 0);
+}
+
 TEST_F(PmTest, GetExistPackage) {
     PackageInfo info;
     EXPECT_EQ(pm.getPackageInfo(mExistPackage, &info), 0);
     EXPECT_STREQ(mExistPackage.c_str(), info.packageName.c_str());
 }
 
+TEST_F(PmTest, PackageSizeMatchesDirectory) {
+    PackageInfo info;
+    ASSERT_EQ(pm.getPackageInfo(mExistPackage, &info), 0);
+    // PackageStats has no unknown size, a package not measured yet is walked on the spot
+    PackageStats stats;
+    ASSERT_EQ(pm.getPackageSizeInfo(mExistPackage, &stats), 0);
+    EXPECT_EQ(stats.codeSize, getDirectorySize(info.installedPath.c_str()));
+    // an unmeasured package reports an unknown size until its background walk finishes
+    for (int i = 0; i < 50 && info.size == PACKAGE_SIZE_UNKNOWN; i++) {
+        usleep(100 * 1000);
+        ASSERT_EQ(pm.getPackageInfo(mExistPackage, &info), 0);
+    }
+    EXPECT_EQ(info.size, getDirectorySize(info.installedPath.c_str()));
+}
+
+TEST_F(PmTest, Sha256KnownAnswer) {
+    const std::string message = "abc";
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    Sha256 sha;
+    sha.update(message.data(), message.length());
+    sha.finish(digest);
+    EXPECT_STREQ(Sha256::toHex(digest).c_str(),
+                 "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+}
+
+static void expectSameManifest(const std::string &json, const PackageInfo &base) {
+    PackageInfo expected = base;
+    PackageInfo actual = base;
+    rapidjson::Document document;
+    int ret = document.Parse(json.c_str()).HasParseError()
+            ? android::BAD_VALUE
+            : PackageParser::parseDocument(document, &expected);
+    EXPECT_EQ(PackageManifestReader::parse(json.c_str(), &actual), ret) << json;
+    EXPECT_STREQ(actual.toString().c_str(), expected.toString().c_str()) << json;
+}
+
+TEST_F(PmTest, ManifestReaderMatchesDocument) {
+    std::vector<PackageInfo> pkgInfos;
+    ASSERT_EQ(pm.getAllPackageInfo(&pkgInfos), 0);
+    for (const auto &pkgInfo : pkgInfos) {
+        std::string json;
+        ASSERT_EQ(readFile(pkgInfo.manifest.c_str(), json), 0);
+        PackageInfo base;
+        base.manifest = pkgInfo.manifest;
+        expectSameManifest(json, base);
+
+        PackageInfo header = base;
+        ASSERT_EQ(PackageManifestReader::parse(json.c_str(), &header, PACKAGE_FIELD_LABEL), 0);
+        EXPECT_STREQ(header.packageName.c_str(), pkgInfo.packageName.c_str());
+        EXPECT_STREQ(header.appType.c_str(), pkgInfo.appType.c_str());
+        EXPECT_STREQ(header.name.c_str(), pkgInfo.name.c_str());
+        EXPECT_TRUE(header.activitiesInfo.empty());
+    }
+
+    const char *manifests[] = {
+            R"({"package":"a","appType":"NATIVE","execfile":"a","entry":"M","isSystemUI":true,)"
+            R"("activities":[{"name":"M","intent-filter":{"actions":["x"]}},{"name":"N"}],)"
+            R"("services":[{"name":"S","exported":true,"priority":"low"}]})",
+            R"({"package":"q","versionCode":7,"features":[{"name":"f"},{"name":""},null],)"
+            R"("router":{"entry":"Home","pages":{"Home":{},"Detail":{},"Home":1}},)"
+            R"("intent-filter":{"actions":["q"]},"services":[{"path":"/bg.js"}]})",
+            R"({"services":[],"package":"late","execfile":"e","entry":"M",)"
+            R"("activities":[{"name":"M"}],"appType":"NATIVE"})",
+            R"({"package":"dup","package":"second","appType":5,"appType":"NATIVE","execfile":"e"})",
+            R"({"package":"v","versionCode":4294967295,"router":[],"features":{"name":"x"}})",
+            R"({"package":"n","appType":"NATIVE","execfile":"e","entry":"Missing"})",
+            R"({"package":"n","appType":"NATIVE","execfile":"e","services":[{}]})",
+            R"({"package":"n","appType":"WEIRD"})",
+            R"({"package":"deep","a":{"package":"inner"},"activities":5,"name":"outer"})",
+            R"({"package":"broken",)",
+            R"(null)",
+    };
+    PackageInfo reparsed;
+    reparsed.packageName = "reparsed";
+    reparsed.appType = "NATIVE";
+    for (const char *json : manifests) {
+        expectSameManifest(json, PackageInfo());
+        expectSameManifest(json, reparsed);
+    }
+
+    // the header tier stops once every header key is seen, the text after them is never read
+    PackageInfo header;
+    ASSERT_EQ(PackageManifestReader::parse(R"({"package":"h","appType":"QUICKAPP",)"
+                                           R"("versionName":"1","name":"H","icon":"i",)"
+                                           R"("isSystemUI":true,"priority":"high",)"
+                                           R"("router":{},"broken":)",
+                                           &header, PACKAGE_FIELD_LABEL),
+              0);
+    EXPECT_EQ(header.priority, getProcessPriority("high"));
+    // a label written after other root keys is still read
+    PackageInfo late;
+    ASSERT_EQ(PackageManifestReader::parse(R"({"package":"l","appType":"NATIVE",)"
+                                           R"("versionName":"1","execfile":"e","entry":"M",)"
+                                           R"("versionCode":2,"activities":[{"name":"M"}],)"
+                                           R"("name":"L","icon":"i","isSystemUI":true})",
+                                           &late, PACKAGE_FIELD_LABEL),
+              0);
+    EXPECT_STREQ(late.name.c_str(), "L");
+    EXPECT_STREQ(late.icon.c_str(), "i");
+    EXPECT_TRUE(late.isSystemUI);
+    EXPECT_EQ(late.priority, getProcessPriority("middle"));
+    PackageInfo native;
+    EXPECT_EQ(PackageManifestReader::parse(R"({"package":"n","appType":"NATIVE",)"
+                                           R"("versionName":"1","activities":[]})",
+                                           &native, PACKAGE_FIELD_LABEL),
+              android::BAD_VALUE);
+}
+
+TEST_F(PmTest, GetPackageInfoFields) {
+    PackageInfo full;
+    ASSERT_EQ(pm.getPackageInfo(mExistPackage, &full), 0);
+    PackageInfo info;
+    ASSERT_EQ(pm.getPackageInfo(mExistPackage, PACKAGE_FIELD_LABEL | PACKAGE_FIELD_LAUNCH, &info),
+              0);
+    EXPECT_EQ(info.fields, PACKAGE_FIELD_LABEL | PACKAGE_FIELD_LAUNCH);
+    EXPECT_TRUE(full.isParsed(PACKAGE_FIELD_MANIFEST));
+    EXPECT_TRUE(info.isParsed(PACKAGE_FIELD_LABEL | PACKAGE_FIELD_LAUNCH));
+    EXPECT_STREQ(info.name.c_str(), full.name.c_str());
+    EXPECT_STREQ(info.icon.c_str(), full.icon.c_str());
+    EXPECT_STREQ(info.entry.c_str(), full.entry.c_str());
+    EXPECT_STREQ(info.execfile.c_str(), full.execfile.c_str());
+    EXPECT_TRUE(info.activitiesInfo.empty());
+    EXPECT_TRUE(info.installedPath.empty());
+
+    std::vector<PackageInfo> pkgInfos;
+    EXPECT_EQ(pm.getAllPackageInfo(PACKAGE_FIELD_VERSION, &pkgInfos), 0);
+    for (const auto &pkgInfo : pkgInfos) {
+        EXPECT_FALSE(pkgInfo.appType.empty());
+        EXPECT_TRUE(pkgInfo.name.empty());
+    }
+}
+
+TEST_F(PmTest, ClientCacheFollowsGeneration) {
+    InstallParam param;
+    param.path = mExistRpkPath;
+    sp<InstallListenerTest> installer = new InstallListenerTest();
+    ASSERT_EQ(pm.installPackage(param, installer), 0);
+    ASSERT_EQ(installer->get_future().get(), 0);
+
+    PackageManager cached;
+    cached.setCacheEnabled(true);
+    PackageInfo first;
+    ASSERT_EQ(cached.getPackageInfo(mInstallPackageName, &first), 0);
+    PackageInfo second;
+    ASSERT_EQ(cached.getPackageInfo(mInstallPackageName, &second), 0);
+    EXPECT_STREQ(first.toString().c_str(), second.toString().c_str());
+    int32_t before;
+    EXPECT_EQ(cached.getGeneration(&before), 0);
+
+    // the cached entry must not outlive the uninstall that bumps the generation
+    UninstallParam uninstallParam;
+    uninstallParam.packageName = mInstallPackageName;
+    sp<UninstallListenerTest> uninstaller = new UninstallListenerTest();
+    ASSERT_EQ(pm.uninstallPackage(uninstallParam, uninstaller), 0);
+    ASSERT_EQ(uninstaller->get_future().get(), 0);
+    int32_t after;
+    EXPECT_EQ(cached.getGeneration(&after), 0);
+    EXPECT_NE(after, before);
+    PackageInfo stale;
+    EXPECT_NE(cached.getPackageInfo(mInstallPackageName, &stale), 0);
+
+    // stats measured in the background don't bump the generation, they are never cached unknown
+    PackageInfo preset;
+    ASSERT_EQ(cached.getPackageInfo(mExistPackage, &preset), 0);
+    for (int i = 0; i < 50 && preset.size == PACKAGE_SIZE_UNKNOWN; i++) {
+        usleep(100 * 1000);
+        ASSERT_EQ(cached.getPackageInfo(mExistPackage, &preset), 0);
+    }
+    EXPECT_EQ(preset.size, getDirectorySize(preset.installedPath.c_str()));
+    EXPECT_FALSE(preset.shasum.empty());
+}
+
+TEST_F(PmTest, GetPackageInfosBatch) {
+    std::vector<std::string> names = {mExistPackage, mNotExistPackage, mExistPackage};
+    std::vector<PackageInfo> pkgInfos;
+    std::vector<int32_t> statuses;
+    ASSERT_EQ(pm.getPackageInfos(names, PACKAGE_FIELD_ALL, &pkgInfos, &statuses), 0);
+    ASSERT_EQ(pkgInfos.size(), names.size());
+    ASSERT_EQ(statuses.size(), names.size());
+    EXPECT_EQ(statuses[0], 0);
+    EXPECT_EQ(statuses[1], android::NAME_NOT_FOUND);
+    EXPECT_EQ(statuses[2], 0);
+    PackageInfo info;
+    ASSERT_EQ(pm.getPackageInfo(mExistPackage, &info), 0);
+    EXPECT_STREQ(pkgInfos[0].toString().c_str(), info.toString().c_str());
+    EXPECT_STREQ(pkgInfos[1].packageName.c_str(), mNotExistPackage.c_str());
+    EXPECT_STREQ(pkgInfos[2].toString().c_str(), info.toString().c_str());
+
+    // more names than one binder call takes, the library splits the batch
+    std::vector<std::string> many(300, mExistPackage);
+    ASSERT_EQ(pm.getPackageInfos(many, PACKAGE_FIELD_VERSION, &pkgInfos, &statuses), 0);
+    ASSERT_EQ(pkgInfos.size(), many.size());
+    ASSERT_EQ(statuses.size(), many.size());
+    EXPECT_EQ(std::count(statuses.begin(), statuses.end(), 0), 300);
+}
+
+TEST_F(PmTest, ParseFailuresAreReported) {
+    std::vector<ParseFailure> failures;
+    ASSERT_EQ(pm.getParseFailures(&failures), 0);
+    for (const auto &failure : failures) {
+        EXPECT_NE(failure.error, 0);
+        EXPECT_FALSE(failure.manifest.empty());
+    }
+
+    PackageFlusher flusher(0, false);
+    PackageParser parser(&flusher);
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "pm_parse_failure";
+    std::filesystem::create_directories(dir);
+    std::string manifest = (dir / "manifest.json").string();
+    ASSERT_EQ(writeFile(manifest.c_str(), R"({"package":"com.broken",)"), 0);
+    PackageInfo info;
+    info.manifest = manifest;
+    EXPECT_EQ(parser.parseManifest(&info), android::BAD_VALUE);
+    failures = parser.getFailures();
+    ASSERT_EQ(failures.size(), 1u);
+    EXPECT_STREQ(failures[0].manifest.c_str(), manifest.c_str());
+    EXPECT_EQ(failures[0].error, android::BAD_VALUE);
+    EXPECT_EQ(failures[0].skipped, 0);
+
+    // unchanged, the recorded error comes back without a parse
+    EXPECT_EQ(parser.parseManifest(&info), android::BAD_VALUE);
+    failures = parser.getFailures();
+    ASSERT_EQ(failures.size(), 1u);
+    EXPECT_EQ(failures[0].skipped, 1);
+
+    ASSERT_EQ(writeFile(manifest.c_str(),
+                        R"({"package":"com.broken","appType":"NATIVE","execfile":"e"})"),
+              0);
+    PackageInfo fixed;
+    fixed.manifest = manifest;
+    EXPECT_EQ(parser.parseManifest(&fixed), 0);
+    EXPECT_STREQ(fixed.packageName.c_str(), "com.broken");
+    EXPECT_TRUE(parser.getFailures().empty());
+    std::filesystem::remove_all(dir);
+}
+
+TEST_F(PmTest, FullPackageInfoKeepsLegacyLayout) {
+    PackageInfo info;
+    ASSERT_EQ(pm.getPackageInfo(mExistPackage, &info), 0);
+    // a full UTF-16 PackageInfo is untagged, older peers read it as before
+    android::Parcel parcel;
+    ASSERT_EQ(info.writeToParcel(&parcel), 0);
+    parcel.setDataPosition(0);
+    EXPECT_EQ(parcel.readInt32(), static_cast<int32_t>(info.packageName.length()));
+    parcel.setDataPosition(0);
+    PackageInfo legacy;
+    ASSERT_EQ(legacy.readFromParcel(&parcel), 0);
+    EXPECT_STREQ(legacy.toString().c_str(), info.toString().c_str());
+
+    PackageInfo projected;
+    projected.assignFields(info, PACKAGE_FIELD_LABEL);
+    android::Parcel tagged;
+    ASSERT_EQ(projected.writeToParcel(&tagged), 0);
+    tagged.setDataPosition(0);
+    PackageInfo decoded;
+    ASSERT_EQ(decoded.readFromParcel(&tagged), 0);
+    EXPECT_EQ(decoded.fields, PACKAGE_FIELD_LABEL);
+    EXPECT_STREQ(decoded.name.c_str(), info.name.c_str());
+}
+
 TEST_F(PmTest, GetNotExistPackage) {
     PackageInfo info;
     EXPECT_NE(pm.getPackageInfo(mNotExistPackage, &info), 0);
@@ -136,9 +510,11 @@ TEST_F(PmTest, InstallExistPackage) {
     std::future<int32_t> f = listener->get_future();
     int result = f.get();
     EXPECT_EQ(result, 0);
+    EXPECT_EQ(listener->mProcess, 100);
     EXPECT_EQ(exists("/data/app/com.application.demo.debug.1.0.0"), true);
     PackageInfo info;
     EXPECT_EQ(pm.getPackageInfo(mInstallPackageName, &info), 0);
+    EXPECT_FALSE(info.shasum.empty());
 }
 
 TEST_F(PmTest, InstallRepeatPackage) {
@@ -156,6 +532,42 @@ TEST_F(PmTest, InstallRepeatPackage) {
     EXPECT_EQ(pm.getPackageInfo(mInstallPackageName, &info), 0);
 }
 
+TEST_F(PmTest, ChangeObserverSeesInstall) {
+    sp<ChangeListenerTest> changes = new ChangeListenerTest();
+    ASSERT_EQ(pm.registerPackageChangeObserver(changes), 0);
+    InstallParam param;
+    param.path = mExistRpkPath;
+    sp<InstallListenerTest> listener = new InstallListenerTest();
+    ASSERT_EQ(pm.installPackage(param, listener), 0);
+    EXPECT_EQ(listener->get_future().get(), 0);
+
+    std::future<PackageChangeEvent> f = changes->get_future();
+    ASSERT_EQ(f.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    PackageChangeEvent event = f.get();
+    int32_t generation;
+    EXPECT_EQ(pm.getGeneration(&generation), 0);
+    EXPECT_EQ(event.generation, generation);
+    EXPECT_EQ(event.updated.size(), 1u);
+    EXPECT_STREQ(event.updated[0].c_str(), mInstallPackageName.c_str());
+    EXPECT_EQ(pm.unregisterPackageChangeObserver(changes), 0);
+}
+
+TEST_F(PmTest, ChangeNotifierWithoutFlusherThread) {
+    // the fallback of a flusher whose thread failed to start, batches go out inline
+    PackageFlusher flusher(0, false);
+    PackageChangeNotifier notifier(&flusher);
+    sp<ChangeListenerTest> changes = new ChangeListenerTest();
+    ASSERT_EQ(notifier.registerObserver(changes), 0);
+    notifier.post(PACKAGE_ADDED, mInstallPackageName, 7);
+    std::future<PackageChangeEvent> f = changes->get_future();
+    ASSERT_EQ(f.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+    PackageChangeEvent event = f.get();
+    EXPECT_EQ(event.generation, 7);
+    ASSERT_EQ(event.added.size(), 1u);
+    EXPECT_STREQ(event.added[0].c_str(), mInstallPackageName.c_str());
+    EXPECT_EQ(notifier.unregisterObserver(changes), 0);
+}
+
 TEST_F(PmTest, UninstallPackage) {
     UninstallParam uninstallparam;
     uninstallparam.packageName = mInstallPackageName;